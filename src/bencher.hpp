@@ -2,6 +2,7 @@
 #define SIGMOID_BENCHER_HPP
 
 #include <chrono>
+#include <random>
 
 #include "engine.hpp"
 
@@ -54,6 +55,7 @@ struct Bencher{
         auto startTime = std::chrono::high_resolution_clock::now();
 
         uint64_t totalVisited = 0;
+        TTStats ttStats;
         TranspositionTable tt;
         tt.resize(16);
         Board b;
@@ -69,13 +71,123 @@ struct Bencher{
                 ops.tt = &tt;
             e.start_searching(ops);
             totalVisited += ops.totalNodesVisited;
+            ttStats.add(ops.ttStats);
             std::cout << " " << std::endl;
         }
 
         auto now = std::chrono::high_resolution_clock::now();
         auto result = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime);
+        auto print_tier = [&ttStats](const std::string& name, TTTier tier){
+            std::cout << name << " tt probes " << ttStats.probes[tier] << " hit rate " << ttStats.hit_rate(tier) << "%" << std::endl;
+        };
+        print_tier("main", MAIN_TIER);
+        if (tt.hot)
+            print_tier("hot", HOT_TIER);
+
         std::cout << std::endl << totalVisited  << " nodes " << (totalVisited * 1000) / result.count() << " nps" << std::endl;
     }
+
+    // Make/unmake, movegen and eval throughput over the legal moves of the bench positions, no search involved.
+    static inline constexpr int MOVE_BENCH_ITERATIONS = 20000;
+    static void move_bench(){
+        Zobrist::init();
+        Movegen::init();
+
+        uint64_t made = 0;
+        uint64_t elapsed = 0;
+        uint64_t movegen_elapsed = 0;
+        uint64_t generated_moves = 0;
+        uint64_t eval_elapsed = 0;
+        int64_t eval_sum = 0;
+        Board b;
+
+        for (const std::string& position : positions){
+            b.load_from_fen(position);
+            std::array<Move, MAX_POSSIBLE_MOVES> moves;
+            int size = 0;
+            Movegen::generate_moves<false>(*b.currentState, b.whoPlay, moves, size);
+
+            auto startTime = std::chrono::high_resolution_clock::now();
+            for (int iteration = 0; iteration < MOVE_BENCH_ITERATIONS; iteration++){
+                for (int i = 0; i < size; i++){
+                    b.make_move(moves[i]);
+                    b.undo_move();
+                    made++;
+                }
+            }
+            auto now = std::chrono::high_resolution_clock::now();
+            elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(now - startTime).count();
+
+            startTime = std::chrono::high_resolution_clock::now();
+            for (int iteration = 0; iteration < MOVE_BENCH_ITERATIONS; iteration++){
+                int generated = 0;
+                Movegen::generate_moves<false>(*b.currentState, b.whoPlay, moves, generated);
+                generated_moves += generated;
+            }
+            now = std::chrono::high_resolution_clock::now();
+            movegen_elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(now - startTime).count();
+
+            startTime = std::chrono::high_resolution_clock::now();
+            for (int iteration = 0; iteration < MOVE_BENCH_ITERATIONS; iteration++)
+                eval_sum += b.eval();
+            now = std::chrono::high_resolution_clock::now();
+            eval_elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(now - startTime).count();
+        }
+
+        const uint64_t evals = positions.size() * MOVE_BENCH_ITERATIONS;
+        std::cout << evals << " movegens " << static_cast<double>(movegen_elapsed) / evals << " ns/movegen ("
+                  << generated_moves << " moves)" << std::endl;
+        std::cout << made << " make/unmake " << elapsed / std::max<uint64_t>(made, 1) << " ns/move "
+                  << (made * 1000000000) / std::max<uint64_t>(elapsed, 1) << " moves/s" << std::endl;
+        std::cout << evals << " evals " << static_cast<double>(eval_elapsed) / evals << " ns/eval (checksum " << eval_sum << ")" << std::endl;
+    }
+
+    // Feature transformer quiet-move updates (sub + add) on random rows, int16 against int8 weights.
+    // With 16 king buckets the larger tables no longer fit in L2 and the updates are bound by the row loads.
+    static inline constexpr int FT_BENCH_UPDATES = 4000000;
+    template<int size, int buckets, typename Weight>
+    static void ft_bench(){
+        struct alignas(Simd::ALIGNMENT) WeightTable{
+            std::array<std::array<Weight, size>, buckets * NUM_FEATURES> rows;
+        };
+        std::unique_ptr<WeightTable> weights = std::make_unique<WeightTable>();
+        std::vector<int> rows(1 << 16);
+        std::mt19937 generator(42);
+        for (auto& row : weights->rows)
+            for (Weight& weight : row)
+                weight = Weight(int(generator() % 64) - 32);
+        for (int& row : rows)
+            row = int(generator() % (buckets * NUM_FEATURES));
+
+        alignas(Simd::ALIGNMENT) std::array<std::array<int16_t, size>, 2> accumulators{};
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < FT_BENCH_UPDATES; i++){
+            const Weight* added = weights->rows[rows[i % rows.size()]].data();
+            const Weight* removed = weights->rows[rows[(i + 1) % rows.size()]].data();
+            update_accumulator<size, 1, 1, Weight>(accumulators[~i & 1].data(), accumulators[i & 1].data(), {added}, {removed});
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+        std::cout << "hidden " << size << " buckets " << buckets << (sizeof(Weight) == 1 ? " int8  " : " int16 ")
+                  << static_cast<double>(elapsed) / FT_BENCH_UPDATES << " ns/update (checksum " << accumulators[0][0] << ")" << std::endl;
+    }
+
+    template<int size, int buckets>
+    static void ft_bench_pair(){
+        ft_bench<size, buckets, int16_t>();
+        ft_bench<size, buckets, int8_t>();
+    }
+
+    static void ft_bench(){
+        ft_bench_pair<128, 1>();
+        ft_bench_pair<256, 1>();
+        ft_bench_pair<512, 1>();
+        ft_bench_pair<1024, 1>();
+        ft_bench_pair<128, 16>();
+        ft_bench_pair<256, 16>();
+        ft_bench_pair<512, 16>();
+        ft_bench_pair<1024, 16>();
+    }
 };
 
 #endif //SIGMOID_BENCHER_HPP
@@ -44,6 +44,21 @@ namespace Sigmoid {
         return cnt;
     }
 
+    // High 64 bits of the 128-bit product.
+    static inline uint64_t mul_hi64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+        __extension__ using uint128 = unsigned __int128;
+        return uint64_t((uint128(a) * uint128(b)) >> 64);
+#else
+        const uint64_t a_lo = uint32_t(a), a_hi = a >> 32;
+        const uint64_t b_lo = uint32_t(b), b_hi = b >> 32;
+        const uint64_t lo_lo = a_lo * b_lo;
+        const uint64_t hi_lo = a_hi * b_lo;
+        const uint64_t lo_hi = a_lo * b_hi;
+        const uint64_t cross = (lo_lo >> 32) + uint32_t(hi_lo) + lo_hi;
+        return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+    }
 
     static inline void print_bitboard(const uint64_t& bb){
         for (int i = 0; i < 64; i++){
@@ -2,6 +2,7 @@
 #define SIGMOID_BOARD_HPP
 
 #include <cstdint>
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <string>
@@ -20,40 +21,59 @@
 
 namespace Sigmoid {
     struct Board{
+        // States of the game and search line, the current one is stateStack[ply] and the ones below it
+        // are its ancestors. Moves write the child state in place, undo only steps back.
         std::array<State, STACK_SIZE_P1> stateStack;
         int ply = 0;
         Color whoPlay;
-        State currentState;
+        State* currentState = stateStack.data();
         NNUE nnue;
 
         Board(): ply(0) { }
 
+        // Only the used part of the stack is copied, currentState points into the own stack.
+        Board(const Board& other) : ply(other.ply), whoPlay(other.whoPlay), currentState(stateStack.data() + other.ply), nnue(other.nnue){
+            std::copy(other.stateStack.begin(), other.stateStack.begin() + ply + 1, stateStack.begin());
+        }
+
+        Board& operator=(const Board& other){
+            if (this == &other)
+                return *this;
+
+            std::copy(other.stateStack.begin(), other.stateStack.begin() + other.ply + 1, stateStack.begin());
+            ply = other.ply;
+            whoPlay = other.whoPlay;
+            currentState = stateStack.data() + ply;
+            nnue = other.nnue;
+            return *this;
+        }
+
         [[nodiscard]] bool is_capture(const Move& move) const {
-            return currentState.pieceMap[move.to()] != NONE || move.special_type() == Move::EN_PASSANT;
+            return currentState->pieceMap[move.to()] != NONE || move.special_type() == Move::EN_PASSANT;
         }
 
         Piece at(int square) const{
-            return currentState.pieceMap[square];
+            return currentState->pieceMap[square];
         }
 
         const uint64_t& key() const{
-            return currentState.zobristKey;
+            return currentState->zobristKey;
         }
 
-        bool make_move(const Move& move){
-            return whoPlay == WHITE ? make_move<WHITE>(move) : make_move<BLACK>(move);
+        // Moves come from the legal movegen, so they are applied without any legality check.
+        void make_move(const Move& move){
+            whoPlay == WHITE ? make_move<WHITE>(move) : make_move<BLACK>(move);
         }
         template<Color us>
-        bool make_move(const Move& move) {
-            if (is_illegal<us>(currentState, move))
-                return false;
-
+        void make_move(const Move& move) {
+            assert(ply + 1 < STACK_SIZE_P1);
             constexpr Color op = ~us;
-            State new_state = currentState;
+            State& new_state = stateStack[ply + 1];
+            new_state = *currentState;
             uint64_t prev_castling = new_state.castling;
 
-            if (currentState.enPassantSquare != NO_SQUARE)
-                new_state.zobristKey ^= Zobrist::epSquares[currentState.enPassantSquare];
+            if (currentState->enPassantSquare != NO_SQUARE)
+                new_state.zobristKey ^= Zobrist::epSquares[currentState->enPassantSquare];
 
             new_state.zobristKey ^= Zobrist::sideToMove;
             new_state.enPassantSquare = NO_SQUARE;
@@ -75,10 +95,11 @@ namespace Sigmoid {
                 captured = new_state.pieceMap[to];
                 assert(captured != NONE);
                 disable_cap_castling<us>(new_state, move);
-                new_state.bitboards[captured].pop_bit<op>(to);
+                new_state.pop_bit<op>(to, captured);
 
                 new_state.zobristKey ^= Zobrist::pieceKeys[~us][captured][to];
                 new_state.halfMove = 0;
+                new_state.pieceCount--;
             }
             else{
                 new_state.halfMove = piece == PAWN ? 0 : new_state.halfMove + 1;
@@ -102,8 +123,8 @@ namespace Sigmoid {
             if (promo_piece != NONE)
                 to_piece = promo_piece;
 
-            new_state.bitboards[piece].pop_bit<us>(from);
-            new_state.bitboards[to_piece].set_bit<us>(to);
+            new_state.pop_bit<us>(from, piece);
+            new_state.set_bit<us>(to, to_piece);
 
             new_state.pieceMap[from] = NONE;
             new_state.pieceMap[to] = to_piece;
@@ -118,79 +139,65 @@ namespace Sigmoid {
                 new_state.zobristKey ^= Zobrist::castlingKeys[new_state.castling];
             }
 
-            uint64_t tmp = new_state.bitboards[KING].get<us>();
-            int new_king_pos = bit_scan_forward_pop_lsb(tmp);
-            if (Movegen::is_square_attacked<us>(new_state, new_king_pos))
-                return false;
-
-
-            nnue.push();
-
+            // Generated moves are legal by construction (check and pin masks), the perft counts of MovegenTests verify it.
+            DirtyPieces dirty_pieces;
             if (is_cap)
             {
                 assert(captured != NONE);
-                nnue.sub(~us, captured, to);
+                dirty_pieces.sub(~us, captured, to);
             }
             else{
                 switch (special_type) {
                     case Move::EN_PASSANT:
-                        handle_ep_nnue<us>(to);
+                        handle_ep_nnue<us>(dirty_pieces, to);
                         break;
                     case Move::CASTLE:
-                        handle_castling_nnue<us>(from, to);
+                        handle_castling_nnue<us>(dirty_pieces, from, to);
                         break;
                     default:
                         break;
                 }
             }
-            if (promo_piece != NONE){
-                nnue.sub(us, piece, from);
-                nnue.add(us, to_piece, to);
-            }
-            else{
-                nnue.move_piece(us, piece, from, to);
-            }
+            dirty_pieces.sub(us, piece, from);
+            dirty_pieces.add(us, to_piece, to);
+            nnue.push(dirty_pieces);
 
             whoPlay = ~whoPlay;
-            stateStack[ply] = currentState;
-            currentState = new_state;
-
+            currentState = &new_state;
             ply++;
-            return true;
         }
 
         void undo_move(){
             assert(ply >= 1);
             ply--;
-            currentState = stateStack[ply];
+            currentState--;
             whoPlay = ~whoPlay;
 
             nnue.pop();
         }
 
         void make_null_move(){
-            State new_state = currentState;
+            State& new_state = stateStack[ply + 1];
+            new_state = *currentState;
             new_state.zobristKey ^= Zobrist::sideToMove;
 
-            if (currentState.enPassantSquare != NO_SQUARE)
-                new_state.zobristKey ^= Zobrist::epSquares[currentState.enPassantSquare];
+            if (currentState->enPassantSquare != NO_SQUARE)
+                new_state.zobristKey ^= Zobrist::epSquares[currentState->enPassantSquare];
 
             whoPlay = ~whoPlay;
-            stateStack[ply] = currentState;
-            currentState = new_state;
-
+            currentState = &new_state;
             ply++;
         }
 
         void undo_null_move(){
             ply--;
-            currentState = stateStack[ply];
+            currentState--;
             whoPlay = ~whoPlay;
         }
 
         bool some_big_piece(){
             for(int pc = KNIGHT; pc <= QUEEN; pc++)
-                if (currentState.bitboards[pc].get<WHITE>() || currentState.bitboards[pc].get<BLACK>())
+                if (currentState->bitboards[pc].get<WHITE>() || currentState->bitboards[pc].get<BLACK>())
                     return true;
 
             return false;
@@ -199,22 +206,28 @@ namespace Sigmoid {
         bool in_check() {
             uint64_t king_bb;
             king_bb = whoPlay == BLACK ?
-                    currentState.bitboards[KING].get<BLACK>() : currentState.bitboards[KING].get<WHITE>();
+                    currentState->bitboards[KING].get<BLACK>() : currentState->bitboards[KING].get<WHITE>();
 
             int king_square = bit_scan_forward_pop_lsb(king_bb);
             return whoPlay == BLACK ?
-                Movegen::is_square_attacked<BLACK>(currentState, king_square)
-                        : Movegen::is_square_attacked<WHITE>(currentState, king_square);
+                Movegen::is_square_attacked<BLACK>(*currentState, king_square)
+                        : Movegen::is_square_attacked<WHITE>(*currentState, king_square);
+        }
+
+        // After the network changed, moves made so far can not be undone anymore.
+        void refresh_nnue(){
+            nnue.rebuild(*currentState);
         }
 
         int16_t eval() {
-            return whoPlay == WHITE ? nnue.eval<WHITE>() : nnue.eval<BLACK>();
+            return whoPlay == WHITE ? nnue.eval<WHITE>(*currentState) : nnue.eval<BLACK>(*currentState);
         }
 
         void load_from_fen(std::string fen){
             nnue.reset();
-            currentState.reset();
             ply = 0;
+            currentState = stateStack.data();
+            currentState->reset();
 
             size_t square = 0;
             size_t i = 0;
@@ -234,12 +247,12 @@ namespace Sigmoid {
 
                 Piece piece = LETTER_PIECE_MAP.at(tolower(c));
                 if (isupper(c))
-                    currentState.set_bit<WHITE>(square, piece);
+                    currentState->set_bit<WHITE>(square, piece);
                 else
-                    currentState.set_bit<BLACK>(square, piece);
+                    currentState->set_bit<BLACK>(square, piece);
 
-                nnue.add(isupper(c) ? WHITE : BLACK, piece, square);
-                currentState.pieceMap[square] = piece;
+                currentState->pieceMap[square] = piece;
+                currentState->pieceCount++;
                 square++;
             }
             ++i; // move to a color index in fen.
@@ -254,7 +267,7 @@ namespace Sigmoid {
                     if (c == ' ')
                         break;
 
-                    currentState.set_casting_index(c);
+                    currentState->set_casting_index(c);
                 }
                 i++;
             }
@@ -265,15 +278,16 @@ namespace Sigmoid {
             if (fen[i] != '-'){
                 int col = (fen[i] - 'a');
                 int row = 7 - (fen[++i] - '1');
-                currentState.enPassantSquare = get_square(row, col);
+                currentState->enPassantSquare = get_square(row, col);
             }
 
             i++;
             std::string substr = fen.substr(i);
             std::stringstream ss(substr);
-            ss >> currentState.halfMove >> currentState.fullMove;
+            ss >> currentState->halfMove >> currentState->fullMove;
 
-            currentState.zobristKey = Zobrist::get_key(currentState, whoPlay);
+            currentState->zobristKey = Zobrist::get_key(*currentState, whoPlay);
+            nnue.refresh(*currentState);
         }
 
         // Only for debug.
@@ -281,9 +295,9 @@ namespace Sigmoid {
             for (int row = 0; row < 8; row++){
                 for (int col = 0; col < 8; col++){
                     int i = get_square(row, col);
-                    Piece piece = currentState.pieceMap[i];
+                    Piece piece = currentState->pieceMap[i];
 
-                    if (i == currentState.enPassantSquare){
+                    if (i == currentState->enPassantSquare){
                         std::cout << "E";
                         continue;
                     }
@@ -291,16 +305,16 @@ namespace Sigmoid {
                         std::cout << "-";
                         continue;
                     }
-                    bool upper = currentState.get_bit<WHITE>(i, piece);
+                    bool upper = currentState->get_bit<WHITE>(i, piece);
                     char c = upper ? piece_char<WHITE>(piece) : piece_char<BLACK>(piece);
                     std::cout << c;
                 }
                 std::cout << std::endl;
             }
 
-            std::cout << "HalfMove: " << currentState.halfMove << std::endl;
-            std::cout << "FullMove: " << currentState.fullMove << std::endl;
-            std::cout << "Castling: " << (int)currentState.castling << std::endl;
+            std::cout << "HalfMove: " << currentState->halfMove << std::endl;
+            std::cout << "FullMove: " << currentState->fullMove << std::endl;
+            std::cout << "Castling: " << (int)currentState->castling << std::endl;
             std::cout << std::endl;
         }
 
@@ -319,7 +333,7 @@ namespace Sigmoid {
                         oss << char('0' + no_piece_cnt);
                         no_piece_cnt = 0;
                     }
-                    uint64_t wbb = currentState.bitboards[pc].get<WHITE>();
+                    uint64_t wbb = currentState->bitboards[pc].get<WHITE>();
                     if (get_nth_bit(wbb, square))
                         oss << piece_char<WHITE>(pc);
                     else
@@ -339,21 +353,21 @@ namespace Sigmoid {
             oss << " ";
             oss << (whoPlay == WHITE ? 'w' : 'b') << " ";
 
-            oss << currentState.castling_str() << " ";
+            oss << currentState->castling_str() << " ";
 
-            if (currentState.enPassantSquare == NO_SQUARE)
+            if (currentState->enPassantSquare == NO_SQUARE)
                 oss << "- ";
             else
-                oss << square_to_uci(currentState.enPassantSquare) << " ";
+                oss << square_to_uci(currentState->enPassantSquare) << " ";
 
-            oss << currentState.halfMove << " " << currentState.fullMove;
+            oss << currentState->halfMove << " " << currentState->fullMove;
 
             std::string result = oss.str();
             return result;
         }
 
         [[nodiscard]] bool is_draw() const{
-            if (currentState.halfMove >= 100)
+            if (currentState->halfMove >= 100)
                 return true;
 
             if (is_insufficient_material<WHITE>() && is_insufficient_material<BLACK>())
@@ -361,7 +375,7 @@ namespace Sigmoid {
 
             int hit_count = 0;
             for (int i = 0; i < ply; i++){
-                if (stateStack[i].zobristKey == currentState.zobristKey)
+                if (stateStack[i].zobristKey == currentState->zobristKey)
                     hit_count++;
                 if (hit_count == 2)
                     return true;
@@ -388,9 +402,9 @@ namespace Sigmoid {
             if (value >= 0)
                 return true;
 
-            const uint64_t white = get_occupancy<WHITE>(currentState);
-            const uint64_t black = get_occupancy<BLACK>(currentState);
-            const uint64_t all = white | black;
+            const uint64_t white = currentState->occupancy.get<WHITE>();
+            const uint64_t black = currentState->occupancy.get<BLACK>();
+            const uint64_t all = currentState->allOccupancy;
 
             uint64_t occupied = (all ^ (1ULL << from)) ^ (1ULL << to);
             uint64_t attackers = get_all_attackers(occupied, to);
@@ -413,7 +427,7 @@ namespace Sigmoid {
                 // Least valuable attacker
                 int pc;
                 for(pc = PAWN; pc <= KING; pc++){
-                    if(current_attackers & (currentState.bitboards[pc].get<WHITE>() | currentState.bitboards[pc].get<BLACK>()))
+                    if(current_attackers & (currentState->bitboards[pc].get<WHITE>() | currentState->bitboards[pc].get<BLACK>()))
                         break;
                 }
 
@@ -445,16 +459,16 @@ namespace Sigmoid {
 
         template<Color us>
         [[nodiscard]] bool is_insufficient_material() const{
-            if (currentState.bitboards[QUEEN].get<us>()
-                || currentState.bitboards[ROOK].get<us>()
-                || currentState.bitboards[PAWN].get<us>())
+            if (currentState->bitboards[QUEEN].get<us>()
+                || currentState->bitboards[ROOK].get<us>()
+                || currentState->bitboards[PAWN].get<us>())
                 return false;
 
-            uint64_t bb = currentState.bitboards[BISHOP].get<us>();
+            uint64_t bb = currentState->bitboards[BISHOP].get<us>();
             const int bishop_cnt = count_bits(bb);
             if (bishop_cnt >= 2) return false;
 
-            bb = currentState.bitboards[KNIGHT].get<us>();
+            bb = currentState->bitboards[KNIGHT].get<us>();
             const int knight_cnt = count_bits(bb);
             if (knight_cnt >= 2) return false;
 
@@ -487,8 +501,8 @@ namespace Sigmoid {
 
         template<Color us>
         void move_piece(State& state, int from, int to, Piece piece){
-            state.bitboards[piece].pop_bit<us>(from);
-            state.bitboards[piece].set_bit<us>(to);
+            state.pop_bit<us>(from, piece);
+            state.set_bit<us>(to, piece);
 
             state.zobristKey ^= Zobrist::pieceKeys[us][piece][from];
             state.zobristKey ^= Zobrist::pieceKeys[us][piece][to];
@@ -526,63 +540,26 @@ namespace Sigmoid {
         void handle_ep(State& state, int to){
             const int enemy_pawn_square = us == WHITE ? to + 8 : to - 8;
 
-            state.bitboards[PAWN].pop_bit<~us>(enemy_pawn_square);
+            state.pop_bit<~us>(enemy_pawn_square, PAWN);
             state.pieceMap[enemy_pawn_square] = NONE;
 
             state.zobristKey ^= Zobrist::pieceKeys[~us][PAWN][enemy_pawn_square];
-        }
-
-        inline static uint64_t get_occupancy(const State& state){
-            uint64_t occ = 0ULL;
-            for (const PairBitboard& pb : state.bitboards)
-                occ |= pb.get<WHITE>() | pb.get<BLACK>();
-            return occ;
-        }
-
-        template<Color color>
-        inline static uint64_t get_occupancy(const State& state){
-            uint64_t occ = 0ULL;
-            for (const PairBitboard& pb : state.bitboards)
-                occ |= pb.get<color>();
-            return occ;
-        }
-
-        template<Color us>
-        bool is_illegal(const State& state, const Move& move){
-            if (move.special_type() == Move::CASTLE){
-                const uint64_t occ = get_occupancy(state);
-                const bool kingSide = move.from() < move.to();
-
-                bool result = Movegen::is_square_attacked<us>(state, move.from(), occ);
-                result |= Movegen::is_square_attacked<us>(state, kingSide ? move.from() + 1 : move.from() - 1, occ);
-                result |= Movegen::is_square_attacked<us>(state, move.to(), occ);
-                return result;
-            }
-            else if (state.pieceMap[move.from()] == KING)
-                return Movegen::is_square_attacked<us>(state, move.to());
-
-            return false;
-        }
-
-
-        template<Color us>
-        void move_piece_nnue(int from, int to, Piece piece){
-            nnue.move_piece(us, piece, from, to);
+            state.pieceCount--;
         }
 
         template<Color us>
-        void handle_castling_nnue(int from, int to){
+        void handle_castling_nnue(DirtyPieces& dirtyPieces, int from, int to){
             const bool king_side = from < to;
-            if (king_side)
-                move_piece_nnue<us>(to + 1, to - 1, ROOK);
-            else
-                move_piece_nnue<us>(to - 2, to + 1, ROOK);
+            const int rook_from = king_side ? to + 1 : to - 2;
+            const int rook_to = king_side ? to - 1 : to + 1;
+            dirtyPieces.sub(us, ROOK, rook_from);
+            dirtyPieces.add(us, ROOK, rook_to);
         }
 
         template<Color us>
-        void handle_ep_nnue(int to){
+        void handle_ep_nnue(DirtyPieces& dirtyPieces, int to){
             const int enemy_pawn_square = us == WHITE ? to + 8 : to - 8;
-            nnue.sub(~us, PAWN, enemy_pawn_square);
+            dirtyPieces.sub(~us, PAWN, enemy_pawn_square);
         }
 
         template<Color us>
@@ -604,12 +581,12 @@ namespace Sigmoid {
 
         template<Color us, Piece pc>
         [[nodiscard]] uint64_t get_bitboard() const{
-            return currentState.bitboards[pc].get<us>();
+            return currentState->bitboards[pc].get<us>();
         }
 
         template<Color us>
         [[nodiscard]] uint64_t get_pc_bitboard(Piece pc) const {
-            return currentState.bitboards[pc].get<us>();
+            return currentState->bitboards[pc].get<us>();
         }
     };
 }
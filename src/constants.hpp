@@ -18,6 +18,7 @@ namespace Sigmoid {
     constexpr int16_t CHECKMATE = MAX_VALUE - (MAX_PLY + 1);
     constexpr int16_t CHECKMATE_BOUND = 31000;
     constexpr int16_t DRAW = 0;
+    constexpr int16_t NO_EVAL = MIN_VALUE - 1;
 
     constexpr int16_t NUM_SQUARES = 64;
     constexpr int16_t NUM_PIECES  = 6;
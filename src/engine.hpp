@@ -29,13 +29,16 @@ namespace Sigmoid {
             // Out values.
             int16_t score;
             uint64_t totalNodesVisited;
+            TTStats ttStats;
         };
 
         void start_searching(Options& options){
             Timer timer(options.wTime, options.bTime, options.wInc, options.bInc, options.board.whoPlay);
-            WorkerHelper worker_helper(workers.size(), options.datagen, &timer);
+            WorkerHelper worker_helper(workers.size(), options.datagen, &timer, options.tt);
             std::vector<std::thread> search_threads;
 
+            options.tt->new_search();
+
             for (size_t i = 0; i < workers.size(); ++i) {
                 workers[i].load_state(options.board, options.tt, &worker_helper, &timer, options.depth);
                 search_threads.emplace_back(&Worker::iterative_deepening, &workers[i]);
@@ -46,10 +49,19 @@ namespace Sigmoid {
 
             options.score = worker_helper.bestResult.score;
             options.totalNodesVisited = worker_helper.totalNodesVisited;
+            options.ttStats = tt_stats();
             if (!options.datagen)
                 std::cout << "bestmove " << worker_helper.bestResult.bestMove.to_uci() << std::endl;
         }
 
+        // Counters of all threads, cumulative since the last new game.
+        [[nodiscard]] TTStats tt_stats() const{
+            TTStats stats;
+            for (const Worker& worker : workers)
+                stats.add(worker.ttStats);
+            return stats;
+        }
+
         void new_game(int threadCnt){
             workers = std::vector<Worker>(threadCnt);
 
@@ -10,10 +10,19 @@ int main(int argc, char* args[]) {
         return EXIT_SUCCESS;
     }
     std::string command(args[1]);
+    // Benches take an optional network file, the embedded net is used otherwise.
+    if (argc > 2 && !NNUE::load_network(args[2])){
+        std::cerr << "invalid network file " << args[2] << std::endl;
+        return EXIT_FAILURE;
+    }
     if (command == "test")
         TestRunner::run_all();
     if (command == "bench")
         Bencher::bench();
+    if (command == "movebench")
+        Bencher::move_bench();
+    if (command == "ftbench")
+        Bencher::ft_bench();
 
     // TODO datagen
     return 0;
@@ -0,0 +1,125 @@
+#ifndef SIGMOID_MAPPED_FILE_HPP
+#define SIGMOID_MAPPED_FILE_HPP
+
+#include <array>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Sigmoid {
+    // Memory of a mapping (of a file or anonymous) or of an aligned allocation, released the matching way.
+    struct MappedMemory{
+        void* memory = nullptr;
+        size_t size = 0;
+        bool mapped = false;
+
+        void release(){
+            if (!memory)
+                return;
+
+#if defined(__linux__)
+            if (mapped)
+                munmap(memory, size);
+            else
+                std::free(memory);
+#else
+            std::free(memory);
+#endif
+            memory = nullptr;
+            size = 0;
+            mapped = false;
+        }
+    };
+
+    // Header is read and checked by isValid(header, fileSize) before the file is mapped. Read-only files are
+    // mapped shared, so processes using the same file share its pages; writable ones copy-on-write, so changes
+    // never reach the file. Pages are read lazily on first access. Empty memory, if the file is not valid.
+    template<typename Header, typename Validator>
+    static inline MappedMemory map_file(const std::string& path, bool writable, Header& header, Validator&& isValid){
+        MappedMemory result;
+#if defined(__linux__)
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return result;
+
+        struct stat file_stat{};
+        const bool valid = fstat(fd, &file_stat) == 0
+                           && size_t(file_stat.st_size) >= sizeof(Header)
+                           && pread(fd, &header, sizeof(Header), 0) == sizeof(Header)
+                           && isValid(header, size_t(file_stat.st_size));
+
+        void* file_memory = valid ? mmap(nullptr, file_stat.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                                         writable ? MAP_PRIVATE : MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (file_memory == MAP_FAILED)
+            return result;
+
+        result.memory = file_memory;
+        result.size = file_stat.st_size;
+        result.mapped = true;
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return result;
+
+        const size_t file_size = file.tellg();
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(&header), sizeof(Header));
+        if (!file || !isValid(header, file_size))
+            return result;
+
+        // Page aligned like a mapping, so the payload after the header keeps its alignment.
+        constexpr size_t PAGE_SIZE = 4096;
+        void* buffer = std::aligned_alloc(PAGE_SIZE, (file_size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE);
+        if (!buffer)
+            return result;
+
+        file.seekg(0);
+        file.read(static_cast<char*>(buffer), std::streamsize(file_size));
+        if (!file){
+            std::free(buffer);
+            return result;
+        }
+
+        result.memory = buffer;
+        result.size = file_size;
+#endif
+        return result;
+    }
+
+    // Written next to the target and renamed over it, a file mapped from the same path is never truncated.
+    // The header is built by fill in zeroed storage, so its padding is written as zeros.
+    template<typename Header, typename Fill>
+    static inline bool save_file(const std::string& path, Fill&& fill, const void* payload, size_t payloadSize){
+        const std::string temporary_path = path + ".tmp";
+        {
+            std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+            if (!file)
+                return false;
+
+            alignas(Header) std::array<char, sizeof(Header)> header_bytes{};
+            fill(*new (header_bytes.data()) Header);
+
+            file.write(header_bytes.data(), sizeof(Header));
+            file.write(static_cast<const char*>(payload), std::streamsize(payloadSize));
+            if (!file.flush())
+                return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary_path, path, error);
+        return !error;
+    }
+}
+
+#endif //SIGMOID_MAPPED_FILE_HPP
@@ -9,7 +9,8 @@
 #include "magics.hpp"
 
 namespace Sigmoid{
-    // Pseudo-legal movegen.
+    // Legal movegen: checkers and pinned pieces are found once per node, the targets of every piece
+    // are restricted to the check and pin rays, so every generated move can be made as is.
     struct Movegen{
 
         template<bool captures>
@@ -27,19 +28,19 @@ namespace Sigmoid{
 
             generate_pawn_bitboards<WHITE>();
             generate_pawn_bitboards<BLACK>();
+            generate_ray_bitboards();
             ready = true;
         }
 
         template<Color us>
-        inline static bool is_square_attacked(const State& state, int square, uint64_t all = 0xffffffffffffffff){
+        inline static bool is_square_attacked(const State& state, int square){
+            return is_square_attacked<us>(state, square, state.allOccupancy);
+        }
+
+        // Sliders see through the given occupancy instead of the one of the state.
+        template<Color us>
+        inline static bool is_square_attacked(const State& state, int square, uint64_t all){
             constexpr Color op = ~us;
-            if (all == 0xffffffffffffffff)
-            {
-                all = 0ULL;
-                for (const PairBitboard& pb : state.bitboards){
-                    all |= pb.get<us>() | pb.get<op>();
-                }
-            }
 
             if (Magics::get_rook_moves(all, square) & (state.bitboards[ROOK].get<op>() | state.bitboards[QUEEN].get<op>()))
                 return true;
@@ -59,8 +60,21 @@ namespace Sigmoid{
             return false;
         }
 
+        // Pieces of ~us attacking the square, sliders see through the given occupancy.
+        template<Color us>
+        inline static uint64_t get_attackers(const State& state, int square, uint64_t all){
+            constexpr Color op = ~us;
+            const uint64_t queens = state.bitboards[QUEEN].get<op>();
+            return (Magics::get_rook_moves(all, square) & (state.bitboards[ROOK].get<op>() | queens))
+                   | (Magics::get_bishop_moves(all, square) & (state.bitboards[BISHOP].get<op>() | queens))
+                   | (knightMoves[square] & state.bitboards[KNIGHT].get<op>())
+                   | (pawnAttackMoves[us][square] & state.bitboards[PAWN].get<op>());
+        }
+
         static inline std::array<uint64_t, 64> kingMoves, knightMoves;
         static inline std::array<std::array<uint64_t, 64>, 2> pawnQuietMoves, pawnAttackMoves;
+        // Squares strictly between two aligned squares, and the whole line through them (empty when not aligned).
+        static inline std::array<std::array<uint64_t, 64>, 64> betweenMasks, lineMasks;
     private:
 
         template<bool captures>
@@ -74,25 +88,58 @@ namespace Sigmoid{
             movesRef[size++] = move;
         }
 
+        // En passant removes two pawns from one rank, so it is verified against the sliders separately.
+        template<Color us>
+        static bool is_ep_legal(const State& state, int from, int to, int kingSquare, uint64_t mergedBits, uint64_t checkers){
+            constexpr Color op = ~us;
+            const int captured = us == WHITE ? to + 8 : to - 8;
+            if (checkers & ~(1ULL << captured) & ~(state.bitboards[ROOK].get<op>() | state.bitboards[BISHOP].get<op>() | state.bitboards[QUEEN].get<op>()))
+                return false;
+
+            const uint64_t all = (mergedBits ^ (1ULL << from) ^ (1ULL << captured)) | (1ULL << to);
+            const uint64_t queens = state.bitboards[QUEEN].get<op>();
+            return !(Magics::get_rook_moves(all, kingSquare) & (state.bitboards[ROOK].get<op>() | queens))
+                   && !(Magics::get_bishop_moves(all, kingSquare) & (state.bitboards[BISHOP].get<op>() | queens));
+        }
+
         template<bool captures, Color us>
         static void generate_moves_(const State& state, std::array<Move, MAX_POSSIBLE_MOVES>& movesRef, int& size){
+            constexpr Color op = ~us;
 
-            uint64_t friendly_bits = 0ULL;
-            uint64_t enemy_bits = 0ULL;
-            uint64_t merged_bits = 0ULL;
-
-            for (const PairBitboard& pb : state.bitboards){
-                friendly_bits |= pb.get<us>();
-                enemy_bits    |= pb.get<~us>();
+            const uint64_t friendly_bits = state.occupancy.get<us>();
+            const uint64_t enemy_bits = state.occupancy.get<op>();
+            const uint64_t merged_bits = state.allOccupancy;
+
+            const int king_square = bit_scan_forward(state.bitboards[KING].get<us>());
+            const uint64_t checkers = get_attackers<us>(state, king_square, merged_bits);
+
+            // Targets of the other pieces: block or capture the checker, never a friendly square.
+            // Only the king moves out of a double check.
+            uint64_t target_mask = checkers ? betweenMasks[king_square][bit_scan_forward(checkers)] | checkers : ~0ULL;
+            if (checkers & (checkers - 1))
+                target_mask = 0ULL;
+            target_mask &= ~friendly_bits;
+            filter_captures<captures>(target_mask, enemy_bits);
+
+            // Our pieces alone between the king and an enemy slider, they may only move along that line.
+            uint64_t pinned = 0ULL;
+            const uint64_t enemy_queens = state.bitboards[QUEEN].get<op>();
+            uint64_t snipers = (Magics::get_rook_moves(enemy_bits, king_square) & (state.bitboards[ROOK].get<op>() | enemy_queens))
+                               | (Magics::get_bishop_moves(enemy_bits, king_square) & (state.bitboards[BISHOP].get<op>() | enemy_queens));
+            while (snipers){
+                const uint64_t blockers = betweenMasks[king_square][bit_scan_forward_pop_lsb(snipers)] & merged_bits;
+                if (blockers && !(blockers & (blockers - 1)))
+                    pinned |= blockers & friendly_bits;
             }
-            merged_bits = friendly_bits | enemy_bits;
 
             auto bitboard_to_moves = [&] (int fromSq, uint64_t bb, Move::SpecialType specialType = Move::NONE){
+                if (get_nth_bit(pinned, fromSq))
+                    bb &= lineMasks[king_square][fromSq];
+
                 int to_sq;
                 while (bb){
                     to_sq = bit_scan_forward_pop_lsb(bb);
-                    if (!get_nth_bit(friendly_bits, to_sq))
-                        add(movesRef, size, Move(fromSq, to_sq, specialType));
+                    add(movesRef, size, Move(fromSq, to_sq, specialType));
                 }
             };
 
@@ -102,8 +149,7 @@ namespace Sigmoid{
             uint64_t bb = state.bitboards[ROOK].get<us>();
             while(bb){
                 pos = bit_scan_forward_pop_lsb(bb);
-                moves = Magics::get_rook_moves(merged_bits, pos);
-                filter_captures<captures>(moves, enemy_bits);
+                moves = Magics::get_rook_moves(merged_bits, pos) & target_mask;
                 bitboard_to_moves(pos, moves);
             }
 
@@ -111,8 +157,7 @@ namespace Sigmoid{
             bb = state.bitboards[BISHOP].get<us>();
             while(bb){
                 pos = bit_scan_forward_pop_lsb(bb);
-                moves = Magics::get_bishop_moves(merged_bits, pos);
-                filter_captures<captures>(moves, enemy_bits);
+                moves = Magics::get_bishop_moves(merged_bits, pos) & target_mask;
                 bitboard_to_moves(pos, moves);
             }
 
@@ -120,31 +165,40 @@ namespace Sigmoid{
             bb = state.bitboards[QUEEN].get<us>();
             while(bb){
                 pos = bit_scan_forward_pop_lsb(bb);
-                moves = Magics::get_bishop_moves(merged_bits, pos) | Magics::get_rook_moves(merged_bits, pos);
-                filter_captures<captures>(moves, enemy_bits);
+                moves = (Magics::get_bishop_moves(merged_bits, pos) | Magics::get_rook_moves(merged_bits, pos)) & target_mask;
                 bitboard_to_moves(pos, moves);
             }
 
-            // Knight
-            bb = state.bitboards[KNIGHT].get<us>();
+            // Knight, a pinned one can never move.
+            bb = state.bitboards[KNIGHT].get<us>() & ~pinned;
             while(bb){
                 pos = bit_scan_forward_pop_lsb(bb);
-                moves = knightMoves[pos];
-                filter_captures<captures>(moves, enemy_bits);
+                moves = knightMoves[pos] & target_mask;
                 bitboard_to_moves(pos, moves);
             }
 
-            // King
-            bb = state.bitboards[KING].get<us>();
-            pos = bit_scan_forward_pop_lsb(bb);
-            bitboard_to_moves(pos, captures ? kingMoves[pos] & enemy_bits : kingMoves[pos]);
-            const auto castlingMasks = CASTLING_FREE_MASKS[us];
-
-            if (!captures && state.is_castling_set<us, false>() && (castlingMasks[K_CASTLE] & merged_bits) == 0){
-                add(movesRef, size, Move(pos, pos + 2, Move::CASTLE));
+            // King moves, the king itself is removed so that it does not block the ray of its checker.
+            bb = kingMoves[king_square] & ~friendly_bits;
+            filter_captures<captures>(bb, enemy_bits);
+            const uint64_t without_king = merged_bits ^ (1ULL << king_square);
+            while (bb){
+                const int to_sq = bit_scan_forward_pop_lsb(bb);
+                if (!is_square_attacked<us>(state, to_sq, without_king))
+                    add(movesRef, size, Move(king_square, to_sq));
             }
-            if (!captures && state.is_castling_set<us, true>() && (castlingMasks[Q_CASTLE] & merged_bits) == 0){
-                add(movesRef, size, Move(pos, pos - 2, Move::CASTLE));
+
+            if (!captures && !checkers){
+                const auto castlingMasks = CASTLING_FREE_MASKS[us];
+                if (state.is_castling_set<us, false>() && (castlingMasks[K_CASTLE] & merged_bits) == 0
+                    && !is_square_attacked<us>(state, king_square + 1, merged_bits)
+                    && !is_square_attacked<us>(state, king_square + 2, merged_bits)){
+                    add(movesRef, size, Move(king_square, king_square + 2, Move::CASTLE));
+                }
+                if (state.is_castling_set<us, true>() && (castlingMasks[Q_CASTLE] & merged_bits) == 0
+                    && !is_square_attacked<us>(state, king_square - 1, merged_bits)
+                    && !is_square_attacked<us>(state, king_square - 2, merged_bits)){
+                    add(movesRef, size, Move(king_square, king_square - 2, Move::CASTLE));
+                }
             }
 
             // Pawns
@@ -153,7 +207,7 @@ namespace Sigmoid{
             //  - pre-promotion rank
             //  - double move
             constexpr int64_t pawn_double_push_bb =  PAWN_STARTS[us];
-            constexpr uint64_t promo_ray_bb = PAWN_STARTS[~us];
+            constexpr uint64_t promo_ray_bb = PAWN_STARTS[op];
 
             uint64_t double_push_pawns = state.bitboards[PAWN].get<us>() & pawn_double_push_bb;
             uint64_t promo_pawns       = state.bitboards[PAWN].get<us>() & promo_ray_bb;
@@ -164,15 +218,19 @@ namespace Sigmoid{
             while (simple_push_pawns) {
                 pos = bit_scan_forward_pop_lsb(simple_push_pawns);
                 bb = ((pawnQuietMoves[us][pos] & (~merged_bits)) * !captures)  | (pawnAttackMoves[us][pos] & enemy_bits);
-                bitboard_to_moves(pos, bb);
+                bitboard_to_moves(pos, bb & target_mask);
                 // en-passant.
-                bb = pawnAttackMoves[us][pos] & ep_bitmask;
-                bitboard_to_moves(pos, bb, Move::EN_PASSANT);
+                if ((pawnAttackMoves[us][pos] & ep_bitmask)
+                    && is_ep_legal<us>(state, pos, state.enPassantSquare, king_square, merged_bits, checkers))
+                    add(movesRef, size, Move(pos, state.enPassantSquare, Move::EN_PASSANT));
             }
 
             while (promo_pawns) {
                 pos = bit_scan_forward_pop_lsb(promo_pawns);
-                bb = ((pawnQuietMoves[us][pos] & (~merged_bits)) * !captures) | (pawnAttackMoves[us][pos] & enemy_bits);
+                bb = (((pawnQuietMoves[us][pos] & (~merged_bits)) * !captures) | (pawnAttackMoves[us][pos] & enemy_bits)) & target_mask;
+                if (get_nth_bit(pinned, pos))
+                    bb &= lineMasks[king_square][pos];
+
                 int to_sq;
                 while (bb){
                     to_sq = bit_scan_forward_pop_lsb(bb);
@@ -188,13 +246,13 @@ namespace Sigmoid{
                 bb = (pawnAttackMoves[us][pos] & enemy_bits);
 
                 uint64_t q_moves = ((pawnQuietMoves[us][pos] & (~merged_bits)) * !captures);
-                uint64_t opp_pawn_mask = pawnQuietMoves[~us][(us == WHITE ? pos - 16 : pos + 16)];
+                uint64_t opp_pawn_mask = pawnQuietMoves[op][(us == WHITE ? pos - 16 : pos + 16)];
 
                 if ((q_moves & opp_pawn_mask) == 0ULL){
                     q_moves = 0ULL;
                 }
                 bb |= q_moves;
-                bitboard_to_moves(pos, bb);
+                bitboard_to_moves(pos, bb & target_mask);
             }
         }
 
@@ -270,6 +328,28 @@ namespace Sigmoid{
             }
         }
 
+        // NOTE: This function uses magics.
+        static void generate_ray_bitboards(){
+            for (int from = 0; from < 64; from++){
+                for (int to = 0; to < 64; to++){
+                    betweenMasks[from][to] = 0ULL;
+                    lineMasks[from][to] = 0ULL;
+                    if (from == to)
+                        continue;
+
+                    const uint64_t ends = (1ULL << from) | (1ULL << to);
+                    if (Magics::get_rook_moves(0ULL, from) & (1ULL << to)){
+                        betweenMasks[from][to] = Magics::get_rook_moves(1ULL << to, from) & Magics::get_rook_moves(1ULL << from, to);
+                        lineMasks[from][to] = (Magics::get_rook_moves(0ULL, from) & Magics::get_rook_moves(0ULL, to)) | ends;
+                    }
+                    else if (Magics::get_bishop_moves(0ULL, from) & (1ULL << to)){
+                        betweenMasks[from][to] = Magics::get_bishop_moves(1ULL << to, from) & Magics::get_bishop_moves(1ULL << from, to);
+                        lineMasks[from][to] = (Magics::get_bishop_moves(0ULL, from) & Magics::get_bishop_moves(0ULL, to)) | ends;
+                    }
+                }
+            }
+        }
+
         template<int size, int max_dist>
         static void set_bits_for_square(const std::array<std::pair<int, int>, size>& moves,
                                  uint64_t& bitboard,
@@ -26,10 +26,12 @@ namespace Sigmoid {
 
         MoveList(const Board* board) : board(board) {}
 
+        MoveList(const Board* board, const Move* ttMove) : board(board), ttMove(ttMove) {}
+
 
         Move get(){
             if (!generated){
-                Movegen::generate_moves<captures>(board->currentState, board->whoPlay, moves, size);
+                Movegen::generate_moves<captures>(*board->currentState, board->whoPlay, moves, size);
                 score_moves();
                 generated = true;
             }
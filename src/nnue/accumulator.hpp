@@ -3,37 +3,109 @@
 
 #include <array>
 #include <cstdint>
+#include <cassert>
 #include <algorithm>
+#include <vector>
 
 #include "nnue_consts.hpp"
+#include "simd.hpp"
 #include "../color.hpp"
+#include "../piece.hpp"
 
 namespace Sigmoid{
-    struct Accumulator{
-        std::array<std::array<int16_t, HIDDEN_LAYER_SIZE>, 2> data;
+    struct DirtyPiece{
+        Color color;
+        Piece piece;
+        int square;
+    };
+
+    // Features changed by a single move: quiets and promotions are sub-add,
+    // captures (en passant included) sub-sub-add and castling sub-sub-add-add.
+    struct DirtyPieces{
+        std::array<DirtyPiece, 2> added;
+        std::array<DirtyPiece, 2> removed;
+        int addCount = 0;
+        int subCount = 0;
+
+        void add(Color color, Piece piece, int square){
+            assert(addCount < 2);
+            added[addCount++] = {color, piece, square};
+        }
+
+        void sub(Color color, Piece piece, int square){
+            assert(subCount < 2);
+            removed[subCount++] = {color, piece, square};
+        }
+    };
 
-        Accumulator() = default;
+    // output = input - removed rows + added rows, int8 weight rows are widened and rescaled to int16 on the fly.
+    template<int size, int adds, int subs, typename Weight>
+    inline void update_accumulator(int16_t* output, const int16_t* input,
+                                   const std::array<const Weight*, adds>& added,
+                                   const std::array<const Weight*, subs>& removed) {
+        constexpr int shift = FT_WEIGHT_SHIFT<Weight>;
+#ifdef SIGMOID_SIMD
+        const auto load_row = [](const Weight* address){
+            if constexpr (shift > 0)
+                return Simd::shl_16<shift>(Simd::load_weights(address));
+            else
+                return Simd::load_weights(address);
+        };
 
-        template<Color color>
-        void add(const std::array<int16_t, HIDDEN_LAYER_SIZE>& weights) {
-            for (int i = 0; i < HIDDEN_LAYER_SIZE; i++)
-                data[color][i] += weights[i];
+        for (int i = 0; i < size; i += Simd::INT16_PER_REGISTER){
+            Simd::Vec value = Simd::load(input + i);
+            for (int s = 0; s < subs; s++)
+                value = Simd::sub_16(value, load_row(removed[s] + i));
+            for (int a = 0; a < adds; a++)
+                value = Simd::add_16(value, load_row(added[a] + i));
+            Simd::store(output + i, value);
+        }
+#else
+        for (int i = 0; i < size; i++){
+            int16_t value = input[i];
+            for (int s = 0; s < subs; s++)
+                value -= removed[s][i] * (1 << shift);
+            for (int a = 0; a < adds; a++)
+                value += added[a][i] * (1 << shift);
+            output[i] = value;
         }
+#endif
+    }
+
+    // Bookkeeping of one ply, the values are kept in an AccumulatorBuffer laid out for the active hidden size.
+    struct Accumulator{
+        // Move leading to this accumulator and whether each perspective is already up to date.
+        DirtyPieces dirtyPieces;
+        std::array<bool, 2> computed = {true, true};
+        std::array<int, 2> kingSquares = {0, 0};
+    };
+
+    // Accumulator values of a hidden layer size chosen at runtime, a slot holds a single perspective.
+    // Every slot starts on a cache line, copies are deep.
+    struct AccumulatorBuffer{
+        struct alignas(Simd::ALIGNMENT) Line{
+            std::array<int16_t, Simd::ALIGNMENT / sizeof(int16_t)> values;
+        };
+
+        std::vector<Line> lines;
+        int hiddenSize = 0;
 
-        template<Color color>
-        void sub(const std::array<int16_t, HIDDEN_LAYER_SIZE>& weights) {
-            for (int i = 0; i < HIDDEN_LAYER_SIZE; i++)
-                data[color][i] -= weights[i];
+        void resize(int slots, int size){
+            assert(size % (Simd::ALIGNMENT / sizeof(int16_t)) == 0);
+            hiddenSize = size;
+            lines.assign(size_t(slots) * size / (Simd::ALIGNMENT / sizeof(int16_t)), Line{});
         }
 
-        template<Color color>
-        std::array<int16_t, HIDDEN_LAYER_SIZE>& get(){
-            return data[color];
+        template<int size>
+        int16_t* slot(int index){
+            assert(size == hiddenSize);
+            return lines.front().values.data() + size_t(index) * size;
         }
 
-        void init(std::array<int16_t, HIDDEN_LAYER_SIZE>& hiddenLayerBiases){
-            data[WHITE] = hiddenLayerBiases;
-            data[BLACK] = hiddenLayerBiases;
+        template<int size>
+        const int16_t* slot(int index) const{
+            assert(size == hiddenSize);
+            return lines.front().values.data() + size_t(index) * size;
         }
     };
 }
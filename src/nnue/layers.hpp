@@ -0,0 +1,158 @@
+#ifndef SIGMOID_LAYERS_HPP
+#define SIGMOID_LAYERS_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "nnue_consts.hpp"
+#include "simd.hpp"
+#include "network.hpp"
+#include "../bitops.hpp"
+
+// Kernels of the int8 hidden layers of layered nets. Activations are uint8 in 0..ACTIVATION_MAX, which keeps
+// every maddubs pair (u8 * i8 + u8 * i8) inside int16, so the results match the scalar loops exactly.
+namespace Sigmoid::Layers{
+    inline constexpr int ACTIVATION_MAX = 127;
+    // Hidden layer weights are quantized by 2^WEIGHT_SHIFT.
+    inline constexpr int WEIGHT_SHIFT = 6;
+    inline constexpr int CHUNK_SIZE = 4;
+
+    // Weight of (output, input) in the chunk-major order: the 4 weights of an input chunk are adjacent for
+    // every output, so a broadcast chunk is multiplied with a whole register of consecutive outputs.
+    template<int outputs>
+    constexpr int chunk_major_index(int output, int input){
+        return (input / CHUNK_SIZE) * outputs * CHUNK_SIZE + output * CHUNK_SIZE + input % CHUNK_SIZE;
+    }
+
+    template<int inputs>
+    inline constexpr std::array<uint16_t, inputs / CHUNK_SIZE> ALL_CHUNKS = []{
+        std::array<uint16_t, inputs / CHUNK_SIZE> chunks{};
+        for (int i = 0; i < inputs / CHUNK_SIZE; i++)
+            chunks[i] = uint16_t(i);
+        return chunks;
+    }();
+
+    // Accumulator clamped to 0..ACTIVATION_MAX and packed to uint8, negatives saturate to 0 in packus.
+    // Feature transformer columns are stored in the packus order (packus_column), the output is in natural order.
+    template<int size>
+    inline void pack_activations(const int16_t* accumulator, uint8_t* output){
+#ifdef SIGMOID_SIMD
+        const Simd::Vec ceiling = Simd::set1_16(ACTIVATION_MAX);
+        for (int i = 0; i < size; i += 2 * Simd::INT16_PER_REGISTER){
+            const Simd::Vec low = Simd::min_16(Simd::load(accumulator + i), ceiling);
+            const Simd::Vec high = Simd::min_16(Simd::load(accumulator + i + Simd::INT16_PER_REGISTER), ceiling);
+            Simd::store(output + i, Simd::packus_16(low, high));
+        }
+#else
+        for (int i = 0; i < size; i++)
+            output[i] = uint8_t(std::clamp<int>(accumulator[i], 0, ACTIVATION_MAX));
+#endif
+    }
+
+    // Indices of the input chunks with a nonzero activation, in increasing order.
+    template<int size>
+    inline int find_nonzero_chunks(const uint8_t* input, uint16_t* chunks){
+        int count = 0;
+#ifdef SIGMOID_SIMD
+        for (int i = 0; i < size; i += Simd::REGISTER_SIZE){
+            uint64_t mask = Simd::nonzero_mask_32(Simd::load(input + i));
+            while (mask)
+                chunks[count++] = uint16_t(i / CHUNK_SIZE + bit_scan_forward_pop_lsb(mask));
+        }
+#else
+        for (int i = 0; i < size / CHUNK_SIZE; i++){
+            uint32_t chunk;
+            std::memcpy(&chunk, input + i * CHUNK_SIZE, CHUNK_SIZE);
+            if (chunk)
+                chunks[count++] = uint16_t(i);
+        }
+#endif
+        return count;
+    }
+
+    // output = biases + weights * input, only the listed input chunks are multiplied (the rest are zero).
+    // Weights are in the chunk-major order.
+    template<int inputs, int outputs>
+    inline void affine(const uint8_t* input, const int8_t* weights, const int32_t* biases,
+                       const uint16_t* chunks, int chunkCount, int32_t* output){
+#ifdef SIGMOID_SIMD
+        constexpr int int32_per_register = Simd::REGISTER_SIZE / sizeof(int32_t);
+        constexpr int registers = outputs / int32_per_register;
+        // Independent sums per chunk parity for narrow layers, a single chain is bound by the dpbusd latency.
+        constexpr int chains = registers < 4 ? 4 : 1;
+        static_assert(outputs % int32_per_register == 0);
+
+        Simd::Vec sums[chains][registers];
+        for (int r = 0; r < registers; r++){
+            sums[0][r] = Simd::load(biases + r * int32_per_register);
+            for (int k = 1; k < chains; k++)
+                sums[k][r] = Simd::zero();
+        }
+
+        const auto accumulate = [input, weights](Simd::Vec* sum, int chunkIndex){
+            int32_t chunk;
+            std::memcpy(&chunk, input + chunkIndex * CHUNK_SIZE, CHUNK_SIZE);
+            const Simd::Vec broadcast = Simd::set1_32(chunk);
+            const int8_t* column = weights + chunkIndex * outputs * CHUNK_SIZE;
+            for (int r = 0; r < registers; r++)
+                sum[r] = Simd::dpbusd_32(sum[r], broadcast, Simd::load(column + r * Simd::REGISTER_SIZE));
+        };
+
+        int c = 0;
+        for (; c + chains <= chunkCount; c += chains)
+            for (int k = 0; k < chains; k++)
+                accumulate(sums[k], chunks[c + k]);
+        for (; c < chunkCount; c++)
+            accumulate(sums[0], chunks[c]);
+
+        for (int r = 0; r < registers; r++){
+            for (int k = 1; k < chains; k++)
+                sums[0][r] = Simd::add_32(sums[0][r], sums[k][r]);
+            Simd::store(output + r * int32_per_register, sums[0][r]);
+        }
+#else
+        for (int o = 0; o < outputs; o++)
+            output[o] = biases[o];
+
+        for (int c = 0; c < chunkCount; c++)
+            for (int o = 0; o < outputs; o++)
+                for (int k = 0; k < CHUNK_SIZE; k++){
+                    const int i = chunks[c] * CHUNK_SIZE + k;
+                    output[o] += input[i] * weights[chunk_major_index<outputs>(o, i)];
+                }
+#endif
+    }
+
+    // Requantization of a layer output to the next layer input.
+    template<int size>
+    inline void activate(const int32_t* input, uint8_t* output){
+        for (int i = 0; i < size; i++)
+            output[i] = uint8_t(std::clamp(input[i] >> WEIGHT_SHIFT, 0, ACTIVATION_MAX));
+    }
+
+    // Load-time transform of a layered file: feature transformer in the packus order, hidden layers in the chunk-major one.
+    template<int hiddenSize, typename FTWeightType>
+    static inline void transform_layered_network(const LayeredNetwork<hiddenSize>& source,
+                                                 LayeredNetworkLayout<FTWeightType, hiddenSize>& target){
+        transform_feature_transformer<(Simd::PACKUS_LANES > 1)>(source.featureTransformer, target.featureTransformer);
+
+        for (int bucket = 0; bucket < OUTPUT_BUCKETS; bucket++){
+            for (int output = 0; output < L1_SIZE; output++)
+                for (int input = 0; input < 2 * hiddenSize; input++)
+                    target.l1Weights[bucket][chunk_major_index<L1_SIZE>(output, input)] = source.l1Weights[bucket][output * 2 * hiddenSize + input];
+
+            for (int output = 0; output < L2_SIZE; output++)
+                for (int input = 0; input < L1_SIZE; input++)
+                    target.l2Weights[bucket][chunk_major_index<L2_SIZE>(output, input)] = source.l2Weights[bucket][output * L1_SIZE + input];
+        }
+
+        target.l1Biases = source.l1Biases;
+        target.l2Biases = source.l2Biases;
+        target.outputWeights = source.outputWeights;
+        target.outputBiases = source.outputBiases;
+    }
+}
+
+#endif //SIGMOID_LAYERS_HPP
@@ -0,0 +1,287 @@
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cassert>
+
+#include "nnue_consts.hpp"
+#include "simd.hpp"
+#include "../mapped_file.hpp"
+
+#ifndef SIGMOID_NETWORK_HPP
+#define SIGMOID_NETWORK_HPP
+
+namespace Sigmoid{
+    // Feature transformer rows (one per input feature) and biases, shared by all network architectures.
+    template<typename FTWeightType, int hiddenSize, int kingBuckets = KING_BUCKETS>
+    struct FeatureTransformer{
+        static_assert(hiddenSize % (2 * Simd::INT16_PER_REGISTER) == 0);
+
+        alignas(Simd::ALIGNMENT) std::array<std::array<FTWeightType, hiddenSize>, kingBuckets * NUM_FEATURES> weights;
+        alignas(Simd::ALIGNMENT) std::array<int16_t, hiddenSize> biases;
+    };
+
+    // Network parameters in the exact layout used for inference, so a mapped file can be used in place.
+    // Feature transformer -> output, the output reads both int16 accumulators directly.
+    template<typename FTWeightType, int hiddenSize, int kingBuckets = KING_BUCKETS, int outputBuckets = OUTPUT_BUCKETS>
+    struct NetworkLayout{
+        static constexpr int HIDDEN_SIZE = hiddenSize;
+        static constexpr int KING_BUCKET_COUNT = kingBuckets;
+        static constexpr int OUTPUT_BUCKET_COUNT = outputBuckets;
+        static constexpr bool LAYERED = false;
+
+        FeatureTransformer<FTWeightType, hiddenSize, kingBuckets> featureTransformer;
+        alignas(Simd::ALIGNMENT) std::array<std::array<int16_t, 2 * hiddenSize>, outputBuckets> hiddenLayerWeights;
+        alignas(Simd::ALIGNMENT) std::array<int16_t, outputBuckets * OUTPUT_SIZE> hiddenLayerBiases;
+    };
+
+    // Feature transformer -> L1_SIZE -> L2_SIZE -> output. Hidden layers are int8 weights with int32 biases
+    // over uint8 activations. Files keep the weights of a layer as [output][input], inference uses the
+    // chunk-major order of the sparse kernels (layers.hpp), which is applied on load.
+    template<typename FTWeightType, int hiddenSize, int kingBuckets = KING_BUCKETS, int outputBuckets = OUTPUT_BUCKETS>
+    struct LayeredNetworkLayout{
+        static constexpr int HIDDEN_SIZE = hiddenSize;
+        static constexpr int KING_BUCKET_COUNT = kingBuckets;
+        static constexpr int OUTPUT_BUCKET_COUNT = outputBuckets;
+        static constexpr bool LAYERED = true;
+
+        FeatureTransformer<FTWeightType, hiddenSize, kingBuckets> featureTransformer;
+        alignas(Simd::ALIGNMENT) std::array<std::array<int8_t, L1_SIZE * 2 * hiddenSize>, outputBuckets> l1Weights;
+        alignas(Simd::ALIGNMENT) std::array<std::array<int32_t, L1_SIZE>, outputBuckets> l1Biases;
+        alignas(Simd::ALIGNMENT) std::array<std::array<int8_t, L2_SIZE * L1_SIZE>, outputBuckets> l2Weights;
+        alignas(Simd::ALIGNMENT) std::array<std::array<int32_t, L2_SIZE>, outputBuckets> l2Biases;
+        alignas(Simd::ALIGNMENT) std::array<std::array<int8_t, L2_SIZE>, outputBuckets> outputWeights;
+        alignas(Simd::ALIGNMENT) std::array<int32_t, outputBuckets> outputBiases;
+    };
+
+    // Files and the embedded net are always int16, inference may use narrowed feature transformer weights.
+    template<int hiddenSize>
+    using Network = NetworkLayout<int16_t, hiddenSize>;
+    template<int hiddenSize>
+    using InferenceNetwork = NetworkLayout<FTWeight, hiddenSize>;
+    template<int hiddenSize>
+    using LayeredNetwork = LayeredNetworkLayout<int16_t, hiddenSize>;
+    template<int hiddenSize>
+    using InferenceLayeredNetwork = LayeredNetworkLayout<FTWeight, hiddenSize>;
+
+    // Nets with one king bucket and one output head (the embedded one), usable with any compiled bucket counts.
+    template<int hiddenSize>
+    using SingleBucketNetwork = NetworkLayout<int16_t, hiddenSize, 1, 1>;
+    template<int hiddenSize>
+    using SingleBucketLayeredNetwork = LayeredNetworkLayout<int16_t, hiddenSize, 1, 1>;
+
+    // Calls kernel.template operator()<size>() with the prebuilt hidden layer size equal to hiddenSize,
+    // so every size gets its own fully unrolled kernels.
+    template<typename Kernel>
+    inline decltype(auto) with_hidden_size(int hiddenSize, Kernel&& kernel){
+        static_assert(HIDDEN_LAYER_SIZES == std::array<int, 4>{128, 256, 512, 1024});
+        switch (hiddenSize){
+            case 256:
+                return kernel.template operator()<256>();
+            case 512:
+                return kernel.template operator()<512>();
+            case 1024:
+                return kernel.template operator()<1024>();
+            default:
+                assert(hiddenSize == 128);
+                return kernel.template operator()<128>();
+        }
+    }
+
+    static inline bool is_supported_hidden_size(int hiddenSize){
+        return std::find(HIDDEN_LAYER_SIZES.begin(), HIDDEN_LAYER_SIZES.end(), hiddenSize) != HIDDEN_LAYER_SIZES.end();
+    }
+
+    // packus interleaves 8-value blocks of its two inputs lane by lane. Feature transformer columns are
+    // stored in the order undoing that, so the packed output is in natural order without any shuffle.
+    // Maps a natural column to its stored position, identity with a single lane.
+    static inline int packus_column(int column){
+        constexpr int block_size = 8;
+        constexpr int group_size = 2 * Simd::PACKUS_LANES * block_size;
+        const int base = column - column % group_size;
+        const int block = (column % group_size) / block_size;
+        const int stored_block = block % 2 == 0 ? block / 2 : Simd::PACKUS_LANES + block / 2;
+        return base + stored_block * block_size + column % block_size;
+    }
+
+    // Format of the file stays the same on every target, the permutation and narrowing are applied on load.
+    // Narrowed weights are rounded to the nearest multiple of 2^FT_WEIGHT_SHIFT and saturate beyond that range.
+    template<bool permute, int hiddenSize, typename FTWeightType>
+    static inline void transform_feature_transformer(const FeatureTransformer<int16_t, hiddenSize>& source,
+                                                     FeatureTransformer<FTWeightType, hiddenSize>& target){
+        constexpr int shift = FT_WEIGHT_SHIFT<FTWeightType>;
+        const auto narrow = [](int weight){
+            if constexpr (shift > 0)
+                weight = (weight + (1 << (shift - 1))) >> shift;
+            return FTWeightType(std::clamp<int>(weight, std::numeric_limits<FTWeightType>::min(), std::numeric_limits<FTWeightType>::max()));
+        };
+
+        for (int row = 0; row < KING_BUCKETS * NUM_FEATURES; row++)
+            for (int column = 0; column < hiddenSize; column++)
+                target.weights[row][permute ? packus_column(column) : column] = narrow(source.weights[row][column]);
+
+        for (int column = 0; column < hiddenSize; column++)
+            target.biases[permute ? packus_column(column) : column] = source.biases[column];
+    }
+
+    template<bool permute, int hiddenSize, typename FTWeightType>
+    static inline void transform_network(const Network<hiddenSize>& source, NetworkLayout<FTWeightType, hiddenSize>& target){
+        transform_feature_transformer<permute>(source.featureTransformer, target.featureTransformer);
+        target.hiddenLayerWeights = source.hiddenLayerWeights;
+        target.hiddenLayerBiases = source.hiddenLayerBiases;
+    }
+
+    // Every king bucket and output head gets a copy of the single one, so the expanded net evaluates identically.
+    template<int hiddenSize>
+    static inline void expand_buckets(const FeatureTransformer<int16_t, hiddenSize, 1>& source, FeatureTransformer<int16_t, hiddenSize>& target){
+        for (int bucket = 0; bucket < KING_BUCKETS; bucket++)
+            std::copy(source.weights.begin(), source.weights.end(), target.weights.begin() + bucket * NUM_FEATURES);
+        target.biases = source.biases;
+    }
+
+    template<int hiddenSize>
+    static inline void expand_buckets(const SingleBucketNetwork<hiddenSize>& source, Network<hiddenSize>& target){
+        expand_buckets(source.featureTransformer, target.featureTransformer);
+        target.hiddenLayerWeights.fill(source.hiddenLayerWeights[0]);
+        target.hiddenLayerBiases.fill(source.hiddenLayerBiases[0]);
+    }
+
+    template<int hiddenSize>
+    static inline void expand_buckets(const SingleBucketLayeredNetwork<hiddenSize>& source, LayeredNetwork<hiddenSize>& target){
+        expand_buckets(source.featureTransformer, target.featureTransformer);
+        target.l1Weights.fill(source.l1Weights[0]);
+        target.l1Biases.fill(source.l1Biases[0]);
+        target.l2Weights.fill(source.l2Weights[0]);
+        target.l2Biases.fill(source.l2Biases[0]);
+        target.outputWeights.fill(source.outputWeights[0]);
+        target.outputBiases.fill(source.outputBiases[0]);
+    }
+
+    static inline size_t network_size(int hiddenSize, bool layered, bool singleBucket){
+        return with_hidden_size(hiddenSize, [layered, singleBucket]<int size>(){
+            if (singleBucket)
+                return layered ? sizeof(SingleBucketLayeredNetwork<size>) : sizeof(SingleBucketNetwork<size>);
+            return layered ? sizeof(LayeredNetwork<size>) : sizeof(Network<size>);
+        });
+    }
+
+    // File layout: [NetworkHeader][Network or LayeredNetwork], header keeps the weights aligned to a cache line.
+    // The hidden layer size, whether the net is layered (l1Size != 0) and whether its inputs are mirrored
+    // are read from the header. Bucket counts are either the compiled ones or a single bucket and head,
+    // the rest of the architecture has to match the compiled one.
+    struct alignas(64) NetworkHeader{
+        std::array<char, 8> magic = NETWORK_MAGIC;
+        uint32_t version = NETWORK_VERSION;
+        uint32_t numFeatures = NUM_FEATURES;
+        uint32_t hiddenSize = EMBEDDED_HIDDEN_LAYER_SIZE;
+        uint32_t kingBuckets = KING_BUCKETS;
+        uint32_t outputBuckets = OUTPUT_BUCKETS;
+        uint32_t mirrored = 0;
+        uint32_t l1Size = 0;
+        uint32_t l2Size = 0;
+        uint64_t networkSize = sizeof(Network<EMBEDDED_HIDDEN_LAYER_SIZE>);
+        uint64_t checksum = 0;
+
+        static inline constexpr std::array<char, 8> NETWORK_MAGIC = {'S', 'I', 'G', 'M', 'O', 'I', 'D', 'N'};
+        static inline constexpr uint32_t NETWORK_VERSION = 2;
+    };
+
+    static_assert(sizeof(NetworkHeader) == 64);
+
+    // FNV-1a over the whole parameter block.
+    static inline uint64_t network_checksum(const void* network, size_t size){
+        const auto* bytes = static_cast<const unsigned char*>(network);
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < size; i++){
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    static inline bool is_valid(const NetworkHeader& header, size_t fileSize){
+        const NetworkHeader expected;
+        const bool layered = header.l1Size != 0;
+        const bool single_bucket = header.kingBuckets == 1 && header.outputBuckets == 1;
+        return header.magic == expected.magic
+               && header.version == expected.version
+               && header.numFeatures == expected.numFeatures
+               && is_supported_hidden_size(int(header.hiddenSize))
+               && (single_bucket || (header.kingBuckets == KING_BUCKETS && header.outputBuckets == OUTPUT_BUCKETS))
+               && header.mirrored <= 1
+               && (layered ? header.l1Size == L1_SIZE && header.l2Size == L2_SIZE : header.l2Size == 0)
+               && header.networkSize == network_size(int(header.hiddenSize), layered, single_bucket)
+               && fileSize == sizeof(NetworkHeader) + header.networkSize;
+    }
+
+    template<typename NetworkType>
+    static inline bool save_network(const NetworkType& network, const std::string& path, bool mirrored = false){
+        return save_file<NetworkHeader>(path, [&](NetworkHeader& header){
+            header.hiddenSize = NetworkType::HIDDEN_SIZE;
+            header.kingBuckets = NetworkType::KING_BUCKET_COUNT;
+            header.outputBuckets = NetworkType::OUTPUT_BUCKET_COUNT;
+            header.mirrored = mirrored;
+            header.l1Size = NetworkType::LAYERED ? L1_SIZE : 0;
+            header.l2Size = NetworkType::LAYERED ? L2_SIZE : 0;
+            header.networkSize = sizeof(NetworkType);
+            header.checksum = network_checksum(&network, sizeof(NetworkType));
+        }, &network, sizeof(NetworkType));
+    }
+
+    // Network file, mapped read-only and shared, so engines on one host using the same file share its pages.
+    struct NetworkFile{
+        MappedMemory file;
+        int hiddenSize = 0;
+        bool layered = false;
+        bool singleBucket = false;
+        bool mirrored = false;
+
+        NetworkFile() = default;
+        NetworkFile(const NetworkFile&) = delete;
+        NetworkFile& operator=(const NetworkFile&) = delete;
+
+        ~NetworkFile(){
+            release();
+        }
+
+        // Parameters of the file, laid out for its hiddenSize, architecture and bucket counts.
+        [[nodiscard]] const void* network() const{
+            return file.memory ? static_cast<const char*>(file.memory) + sizeof(NetworkHeader) : nullptr;
+        }
+
+        // Current file is kept, if the new one is not valid.
+        bool load(const std::string& path){
+            NetworkHeader header;
+            MappedMemory loaded = map_file(path, false, header, is_valid);
+            if (!loaded.memory)
+                return false;
+
+            if (network_checksum(static_cast<const char*>(loaded.memory) + sizeof(NetworkHeader), header.networkSize) != header.checksum){
+                loaded.release();
+                return false;
+            }
+
+            release();
+            file = loaded;
+            hiddenSize = int(header.hiddenSize);
+            layered = header.l1Size != 0;
+            singleBucket = header.kingBuckets == 1 && header.outputBuckets == 1;
+            mirrored = header.mirrored != 0;
+            return true;
+        }
+
+        void release(){
+            file.release();
+            hiddenSize = 0;
+            layered = false;
+            singleBucket = false;
+            mirrored = false;
+        }
+    };
+}
+
+#endif //SIGMOID_NETWORK_HPP
@@ -4,142 +4,447 @@
 #include <cassert>
 #include <string>
 #include <fstream>
+#include <cstddef>
+#include <type_traits>
+#include <bit>
 
 #include "accumulator.hpp"
+#include "network.hpp"
+#include "layers.hpp"
 #include "../constants.hpp"
 #include "../color.hpp"
 #include "../piece.hpp"
+#include "../state.hpp"
+#include "../bitops.hpp"
 #include "sentinel_nnue.hpp"
 
 namespace Sigmoid{
     // TODO custom net 768 -> 128 -> 1 [no perspective] -- to find out, how bad it will be against perspective network.
     struct NNUE{
+        // Accumulator values of stack entry i are in slots 2i (white) and 2i + 1 (black).
         std::array<Accumulator, STACK_SIZE_P1> stack;
+        AccumulatorBuffer accumulators;
         int index = 0;
 
-        static inline std::array<int16_t, OUTPUT_SIZE> hiddenLayerBiases;
-        static inline std::array<int16_t, 2 * HIDDEN_LAYER_SIZE> hiddenLayerWeights;
+        // Refresh cache (Finny table): accumulator of the last position refreshed in each bucket and its pieces,
+        // the accumulator of the perspective and bucket is in slot perspective * INPUT_BUCKETS + bucket.
+        std::array<std::array<std::array<PairBitboard, 6>, INPUT_BUCKETS>, 2> finnyBitboards;
+        AccumulatorBuffer finnyAccumulators;
+        uint32_t finnyGeneration = 0;
+
+        // Embedded net is stored already in the single bucket layout, its bytes become a typed object at compile time,
+        // so nothing is parsed at startup. It is used in place unless the build has more buckets.
+        static_assert(sizeof(SENTINEL_NNUE) == sizeof(SingleBucketNetwork<EMBEDDED_HIDDEN_LAYER_SIZE>));
+        static inline constexpr SingleBucketNetwork<EMBEDDED_HIDDEN_LAYER_SIZE> embeddedNetworkData =
+                std::bit_cast<SingleBucketNetwork<EMBEDDED_HIDDEN_LAYER_SIZE>>(SENTINEL_NNUE);
+        static inline const SingleBucketNetwork<EMBEDDED_HIDDEN_LAYER_SIZE>* const embeddedNetwork = &embeddedNetworkData;
+
+        // Single bucket nets expanded to the compiled bucket counts, only used when those are not 1.
+        template<int size>
+        static inline Network<size> expandedNetwork;
+        template<int size>
+        static inline LayeredNetwork<size> expandedLayeredNetwork;
+
+        template<int size>
+        static const Network<size>* expand(const SingleBucketNetwork<size>* source){
+            if constexpr (std::is_same_v<SingleBucketNetwork<size>, Network<size>>)
+                return source;
+            else{
+                expand_buckets(*source, expandedNetwork<size>);
+                return &expandedNetwork<size>;
+            }
+        }
+
+        template<int size>
+        static const LayeredNetwork<size>* expand(const SingleBucketLayeredNetwork<size>* source){
+            if constexpr (std::is_same_v<SingleBucketLayeredNetwork<size>, LayeredNetwork<size>>)
+                return source;
+            else{
+                expand_buckets(*source, expandedLayeredNetwork<size>);
+                return &expandedLayeredNetwork<size>;
+            }
+        }
 
-        static inline std::array<int16_t, HIDDEN_LAYER_SIZE> inputLayerBiases;
-        static inline std::array<std::array<int16_t, HIDDEN_LAYER_SIZE>, NUM_FEATURES> inputLayerWeights;
+        // Copies in the SIMD layout and weight type, only used when those differ from the stored ones.
+        template<int size>
+        static inline InferenceNetwork<size> preparedNetwork;
+        template<int size>
+        static inline InferenceLayeredNetwork<size> preparedLayeredNetwork;
+
+        // Load-time transform of the stored weights for the weight type, in place use when none is needed.
+        template<int size>
+        static const InferenceNetwork<size>* prepare(const Network<size>* source){
+#ifdef SIGMOID_INT8_FT
+            transform_network<false>(*source, preparedNetwork<size>);
+            return &preparedNetwork<size>;
+#else
+            return source;
+#endif
+        }
+
+        // Layered nets always need a transform, their hidden layers are reordered for the sparse kernels.
+        template<int size>
+        static const InferenceLayeredNetwork<size>* prepare(const LayeredNetwork<size>* source){
+            Layers::transform_layered_network(*source, preparedLayeredNetwork<size>);
+            return &preparedLayeredNetwork<size>;
+        }
+
+        // Weights as stored (embedded or mapped from EvalFile, expanded to the compiled bucket counts)
+        // and the ones used for inference, both in the layout of hiddenSize and layered.
+        static inline NetworkFile networkFile;
+        static inline uint32_t networkGeneration = 0;
+        static inline int hiddenSize = EMBEDDED_HIDDEN_LAYER_SIZE;
+        static inline bool layered = false;
+        static inline bool mirrored = false;
+        static inline const void* storedNetwork = expand(embeddedNetwork);
+        static inline const void* network = prepare(static_cast<const Network<EMBEDDED_HIDDEN_LAYER_SIZE>*>(storedNetwork));
+
+        // Both layouts start with the feature transformer.
+        static_assert(offsetof(InferenceNetwork<EMBEDDED_HIDDEN_LAYER_SIZE>, featureTransformer) == 0);
+        static_assert(offsetof(InferenceLayeredNetwork<EMBEDDED_HIDDEN_LAYER_SIZE>, featureTransformer) == 0);
+
+        template<int size>
+        static const FeatureTransformer<FTWeight, size>* feature_transformer(){
+            assert(size == hiddenSize);
+            return static_cast<const FeatureTransformer<FTWeight, size>*>(network);
+        }
+
+        template<int size>
+        static const InferenceNetwork<size>* inference_network(){
+            assert(size == hiddenSize && !layered);
+            return static_cast<const InferenceNetwork<size>*>(network);
+        }
+
+        template<int size>
+        static const InferenceLayeredNetwork<size>* layered_network(){
+            assert(size == hiddenSize && layered);
+            return static_cast<const InferenceLayeredNetwork<size>*>(network);
+        }
 
         static constexpr int qa = 255;
         static constexpr int qb = 64;
         static constexpr int scale = 400;
 
-        std::string NET_PATH = "../src/nnue/singularity_v2_4-40.bin";
-
         NNUE() {
-            load_from_file();
+            clear_finny_table();
             reset();
         }
 
+        void clear_finny_table(){
+            finnyGeneration = networkGeneration;
+            if (finnyAccumulators.hiddenSize != hiddenSize)
+                finnyAccumulators.resize(2 * INPUT_BUCKETS, hiddenSize);
+
+            with_hidden_size(hiddenSize, [this]<int size>(){
+                const auto& biases = feature_transformer<size>()->biases;
+                for (int slot = 0; slot < 2 * INPUT_BUCKETS; slot++)
+                    std::copy(biases.begin(), biases.end(), finnyAccumulators.slot<size>(slot));
+            });
+
+            for (std::array<std::array<PairBitboard, 6>, INPUT_BUCKETS>& entries : finnyBitboards)
+                for (std::array<PairBitboard, 6>& bitboards : entries)
+                    for (PairBitboard& bb : bitboards)
+                        bb.clear();
+        }
+
         void pop(){
             index--;
         }
 
-        void push(){
-            stack[index + 1] = stack[index];
+        // Only records the move, the accumulator is computed lazily once eval needs it.
+        void push(const DirtyPieces& dirtyPieces){
+            assert(dirtyPieces.addCount >= 1 && dirtyPieces.subCount >= 1);
             index++;
+            stack[index].dirtyPieces = dirtyPieces;
+            stack[index].computed = {false, false};
+            stack[index].kingSquares = stack[index - 1].kingSquares;
+
+            for (int i = 0; i < dirtyPieces.addCount; i++)
+                if (dirtyPieces.added[i].piece == KING)
+                    stack[index].kingSquares[dirtyPieces.added[i].color] = dirtyPieces.added[i].square;
+        }
+
+        template<int size>
+        int16_t* accumulator(int stackIndex, Color perspective){
+            return accumulators.slot<size>(2 * stackIndex + perspective);
+        }
+
+        template<int size>
+        const int16_t* accumulator(int stackIndex, Color perspective) const{
+            return accumulators.slot<size>(2 * stackIndex + perspective);
         }
 
+        // Walks back to the nearest computed ancestor and replays the recorded moves from there.
+        // A king move changing the input bucket on the way means a refresh of the current position instead.
+        template<Color perspective, int size>
+        void materialize(const State& state){
+            int computed_index = index;
+            while (!stack[computed_index].computed[perspective]){
+                if (input_bucket<perspective>(stack[computed_index].kingSquares[perspective])
+                    != input_bucket<perspective>(stack[computed_index - 1].kingSquares[perspective])){
+                    refresh<perspective, size>(state);
+                    return;
+                }
+                computed_index--;
+            }
+
+            assert(computed_index >= 0);
+            for (int i = computed_index + 1; i <= index; i++){
+                update<perspective, size>(i, stack[i].dirtyPieces);
+                stack[i].computed[perspective] = true;
+            }
+        }
+
+        // Buffers follow the hidden layer size of the active network, the refresh cache is dropped once it changes.
         void reset(){
+            if (accumulators.hiddenSize != hiddenSize)
+                accumulators.resize(2 * STACK_SIZE_P1, hiddenSize);
+            if (finnyGeneration != networkGeneration)
+                clear_finny_table();
+
             index = 0;
-            stack[index].init(inputLayerBiases);
-            load_from_file();
+            stack[index].computed = {true, true};
+            with_hidden_size(hiddenSize, [this]<int size>(){
+                const auto& biases = feature_transformer<size>()->biases;
+                std::copy(biases.begin(), biases.end(), accumulator<size>(0, WHITE));
+                std::copy(biases.begin(), biases.end(), accumulator<size>(0, BLACK));
+            });
+        }
+
+        // Builds the current accumulator from the state, only the difference against the cached
+        // position of the same bucket is applied.
+        void refresh(const State& state){
+            with_hidden_size(hiddenSize, [this, &state]<int size>(){
+                refresh<WHITE, size>(state);
+                refresh<BLACK, size>(state);
+            });
+        }
+
+        template<Color perspective, int size>
+        void refresh(const State& state){
+            assert(state.bitboards[KING].get<perspective>() != 0ULL);
+            const int king_square = bit_scan_forward(state.bitboards[KING].get<perspective>());
+            const int bucket = input_bucket<perspective>(king_square);
+            std::array<PairBitboard, 6>& cached_bitboards = finnyBitboards[perspective][bucket];
+            int16_t* cached_accumulator = finnyAccumulators.slot<size>(perspective * INPUT_BUCKETS + bucket);
+            const FeatureTransformer<FTWeight, size>* transformer = feature_transformer<size>();
+
+            for (int piece = PAWN; piece <= KING; piece++){
+                for (Color color : {WHITE, BLACK}){
+                    const uint64_t current = state.bitboards[piece].bitboards[color];
+                    const uint64_t cached = cached_bitboards[piece].bitboards[color];
+
+                    uint64_t removed = cached & ~current;
+                    while (removed){
+                        const FTWeight* weights = transformer->weights[get_index<perspective>(color, Piece(piece), bit_scan_forward_pop_lsb(removed), king_square)].data();
+                        update_accumulator<size, 0, 1, FTWeight>(cached_accumulator, cached_accumulator, {}, {weights});
+                    }
+
+                    uint64_t added = current & ~cached;
+                    while (added){
+                        const FTWeight* weights = transformer->weights[get_index<perspective>(color, Piece(piece), bit_scan_forward_pop_lsb(added), king_square)].data();
+                        update_accumulator<size, 1, 0, FTWeight>(cached_accumulator, cached_accumulator, {weights}, {});
+                    }
+                }
+            }
+            cached_bitboards = state.bitboards;
+
+            std::copy(cached_accumulator, cached_accumulator + size, accumulator<size>(index, perspective));
+            stack[index].kingSquares[perspective] = king_square;
+            stack[index].computed[perspective] = true;
         }
 
         static int crelu(int value) {
             return std::clamp(value, 0, qa);
         }
 
-        void add(Color pieceColor, Piece piece, int square){
-            assert(index >= 0);
-            Accumulator* current_accumulator = &stack[index];
-            int w_feature_index = get_index<WHITE>(pieceColor, piece, square);
-            int b_feature_index = get_index<BLACK>(pieceColor, piece, square);
+        // Fused parent copy and update, the parent is read once and the child written once.
+        template<Color perspective, int size>
+        void update(int childIndex, const DirtyPieces& dirtyPieces){
+            const int king_square = stack[childIndex].kingSquares[perspective];
+            const FeatureTransformer<FTWeight, size>* transformer = feature_transformer<size>();
+            const auto weights = [king_square, transformer](const DirtyPiece& dp){
+                return transformer->weights[get_index<perspective>(dp.color, dp.piece, dp.square, king_square)].data();
+            };
+
+            int16_t* child = accumulator<size>(childIndex, perspective);
+            const int16_t* parent = accumulator<size>(childIndex - 1, perspective);
+            const FTWeight* add0 = weights(dirtyPieces.added[0]);
+            const FTWeight* sub0 = weights(dirtyPieces.removed[0]);
+            if (dirtyPieces.subCount == 1)
+                update_accumulator<size, 1, 1, FTWeight>(child, parent, {add0}, {sub0});
+            else if (dirtyPieces.addCount == 1)
+                update_accumulator<size, 1, 2, FTWeight>(child, parent, {add0}, {sub0, weights(dirtyPieces.removed[1])});
+            else
+                update_accumulator<size, 2, 2, FTWeight>(child, parent, {add0, weights(dirtyPieces.added[1])},
+                                                         {sub0, weights(dirtyPieces.removed[1])});
+        }
 
-            current_accumulator->add<WHITE>(inputLayerWeights[w_feature_index]);
-            current_accumulator->add<BLACK>(inputLayerWeights[b_feature_index]);
+        template<Color color>
+        int16_t eval(const State& state) {
+            return with_hidden_size(hiddenSize, [this, &state]<int size>(){
+                return eval<color, size>(state);
+            });
         }
 
-        void sub(Color pieceColor, Piece piece, int square){
+        template<Color color, int size>
+        int16_t eval(const State& state) {
             assert(index >= 0);
-            Accumulator* current_accumulator = &stack[index];
-            int w_feature_index = get_index<WHITE>(pieceColor, piece, square);
-            int b_feature_index = get_index<BLACK>(pieceColor, piece, square);
+            // Repeated evals of a position skip the (out of line) walk back.
+            if (!stack[index].computed[WHITE])
+                materialize<WHITE, size>(state);
+            if (!stack[index].computed[BLACK])
+                materialize<BLACK, size>(state);
+            if (layered)
+                return eval_layered<color, size>(state);
+
+            const int16_t* our_accumulator = accumulator<size>(index, color);
+            const int16_t* opp_accumulator = accumulator<size>(index, ~color);
+            const InferenceNetwork<size>* net = inference_network<size>();
+            const int bucket = output_bucket(state.pieceCount);
+            const auto& weights = net->hiddenLayerWeights[bucket];
+
+            int eval = net->hiddenLayerBiases[bucket];
+#ifdef SIGMOID_SIMD
+            // madd widens the products to int32 and adds pairs without overflow (2 * qa * 2^15 < 2^31),
+            // integer sums are order independent, so the result is identical to the scalar loops.
+            const Simd::Vec zero = Simd::zero();
+            const Simd::Vec ceiling = Simd::set1_16(qa);
+            Simd::Vec sum = Simd::zero();
+            for (int i = 0; i < size; i += Simd::INT16_PER_REGISTER){
+                const Simd::Vec our = Simd::min_16(Simd::max_16(Simd::load(&our_accumulator[i]), zero), ceiling);
+                const Simd::Vec opp = Simd::min_16(Simd::max_16(Simd::load(&opp_accumulator[i]), zero), ceiling);
+                sum = Simd::add_32(sum, Simd::madd_16(our, Simd::load(&weights[i])));
+                sum = Simd::add_32(sum, Simd::madd_16(opp, Simd::load(&weights[i + size])));
+            }
+            eval += Simd::hsum_32(sum);
+#else
+            for (int i = 0 ; i < size; i++)
+                eval += weights[i] * crelu(our_accumulator[i]);
+
+            for (int i = 0; i < size; i++)
+                eval += weights[i + size] * crelu(opp_accumulator[i]);
+#endif
 
-            current_accumulator->sub<WHITE>(inputLayerWeights[w_feature_index]);
-            current_accumulator->sub<BLACK>(inputLayerWeights[b_feature_index]);
+            eval *= scale;
+            eval /= qa * qb;
+            return eval;
         }
 
-        void move_piece(Color pieceColor, Piece piece, int from, int to){
-            sub(pieceColor, piece, from);
-            add(pieceColor, piece, to);
-        }
+        // Feature transformer -> L1 -> L2 -> output. Most L1 inputs are zero after the clamp, so L1 only
+        // multiplies the nonzero 4-input chunks, the small L2 and the output are dense.
+        template<Color color, int size>
+        int16_t eval_layered(const State& state) {
+            const InferenceLayeredNetwork<size>* net = layered_network<size>();
+            const int bucket = output_bucket(state.pieceCount);
 
-        template<Color color>
-        int16_t eval() {
-            assert(index >= 0);
-            const auto our_accumulator = stack[index].get<color>();
-            const auto opp_accumulator = stack[index].get<~color>();
+            alignas(Simd::ALIGNMENT) std::array<uint8_t, 2 * size> input;
+            Layers::pack_activations<size>(accumulator<size>(index, color), input.data());
+            Layers::pack_activations<size>(accumulator<size>(index, ~color), input.data() + size);
 
-            int eval = hiddenLayerBiases[0];
-            for (int i = 0 ; i < HIDDEN_LAYER_SIZE; i++)
-                eval += hiddenLayerWeights[i] * crelu(our_accumulator[i]);
+            std::array<uint16_t, 2 * size / Layers::CHUNK_SIZE> chunks;
+            const int chunk_count = Layers::find_nonzero_chunks<2 * size>(input.data(), chunks.data());
 
-            for (int i = 0; i < HIDDEN_LAYER_SIZE; i++)
-                eval += hiddenLayerWeights[i + HIDDEN_LAYER_SIZE] * crelu(opp_accumulator[i]);
+            alignas(Simd::ALIGNMENT) std::array<int32_t, L1_SIZE> l1_output;
+            alignas(Simd::ALIGNMENT) std::array<uint8_t, L1_SIZE> l1_activations;
+            Layers::affine<2 * size, L1_SIZE>(input.data(), net->l1Weights[bucket].data(), net->l1Biases[bucket].data(),
+                                              chunks.data(), chunk_count, l1_output.data());
+            Layers::activate<L1_SIZE>(l1_output.data(), l1_activations.data());
+
+            alignas(Simd::ALIGNMENT) std::array<int32_t, L2_SIZE> l2_output;
+            alignas(Simd::ALIGNMENT) std::array<uint8_t, L2_SIZE> l2_activations;
+            Layers::affine<L1_SIZE, L2_SIZE>(l1_activations.data(), net->l2Weights[bucket].data(), net->l2Biases[bucket].data(),
+                                             Layers::ALL_CHUNKS<L1_SIZE>.data(), L1_SIZE / Layers::CHUNK_SIZE, l2_output.data());
+            Layers::activate<L2_SIZE>(l2_output.data(), l2_activations.data());
+
+            int eval = net->outputBiases[bucket];
+            for (int i = 0; i < L2_SIZE; i++)
+                eval += l2_activations[i] * net->outputWeights[bucket][i];
 
             eval *= scale;
-            eval /= qa * qb;
+            eval /= Layers::ACTIVATION_MAX * (1 << Layers::WEIGHT_SHIFT);
             return eval;
         }
 
+        // Pieces (kings included) split evenly over the buckets, 2..32 pieces.
+        static int output_bucket(int pieceCount){
+            constexpr int divisor = (32 + OUTPUT_BUCKETS - 1) / OUTPUT_BUCKETS;
+            return std::min((pieceCount - 2) / divisor, OUTPUT_BUCKETS - 1);
+        }
+
+        // Bucket index of the king square, mirrored halves get their own accumulator cache entries.
         template<Color perspective>
-        int get_index(Color pieceColor, Piece piece, int square){
+        static int input_bucket(int kingSquare){
+            const int relative_square = perspective == WHITE ? kingSquare ^ 56 : kingSquare;
+            return KING_BUCKET_LAYOUT[relative_square] * 2 + (mirrored && (kingSquare & 7) >= 4);
+        }
+
+        template<Color perspective>
+        static int get_index(Color pieceColor, Piece piece, int square, int kingSquare){
             int color_index = (pieceColor == perspective) ? 0 : 1;
             int piece_index = piece;
             int square_index = perspective == WHITE ? square ^ 56: square;
+            if (mirrored && (kingSquare & 7) >= 4)
+                square_index ^= 7;
 
-            int result_index = color_index * 384 + piece_index * 64 + square_index;
-            assert(result_index >= 0 && result_index <= 767);
+            const int bucket = KING_BUCKET_LAYOUT[perspective == WHITE ? kingSquare ^ 56 : kingSquare];
+            int result_index = bucket * NUM_FEATURES + color_index * 384 + piece_index * 64 + square_index;
+            assert(result_index >= 0 && result_index < KING_BUCKETS * NUM_FEATURES);
             return result_index;
         }
 
-        template<typename T>
-        T read_number(std::istringstream& stream){
-            T value;
-            stream.read(reinterpret_cast<char*>(&value), sizeof(value));
-            return value;
+        // Empty path switches back to the embedded net. Current net is kept, if the file is not valid.
+        // Existing accumulators are stale afterward (and laid out for the old size), boards have to be refreshed
+        // or load a position.
+        static bool load_network(const std::string& path){
+            if (path.empty() || path == "<empty>"){
+                use_network(embeddedNetwork, EMBEDDED_HIDDEN_LAYER_SIZE, false, true, false);
+                networkFile.release();
+                return true;
+            }
+
+            if (!networkFile.load(path))
+                return false;
+
+            use_network(networkFile.network(), networkFile.hiddenSize, networkFile.layered, networkFile.singleBucket, networkFile.mirrored);
+            return true;
         }
 
-        static inline bool loaded = false;
-
-        void load_from_file() {
-            if (loaded)
-                return;
-
-            std::istringstream stream;
-            auto size = sizeof(SENTINEL_NNUE) / sizeof (unsigned char);
-            stream.rdbuf()->pubsetbuf((char *) SENTINEL_NNUE, size);
-
-            for(int i = 0; i < NUM_FEATURES; i++)
-                for(int x = 0; x < HIDDEN_LAYER_SIZE; x++)
-                    inputLayerWeights[i][x] = read_number<int16_t>(stream);
-
-            assert(!stream.eof());
-            for(int i = 0; i < HIDDEN_LAYER_SIZE; i++)
-                inputLayerBiases[i] = read_number<int16_t>(stream);
-
+        static void use_network(const void* stored, int size, bool isLayered, bool singleBucket, bool isMirrored){
+            networkGeneration++;
+            hiddenSize = size;
+            layered = isLayered;
+            mirrored = isMirrored;
+            with_hidden_size(size, [stored, isLayered, singleBucket]<int s>(){
+                if (isLayered){
+                    const LayeredNetwork<s>* net = singleBucket ? expand(static_cast<const SingleBucketLayeredNetwork<s>*>(stored))
+                                                                : static_cast<const LayeredNetwork<s>*>(stored);
+                    storedNetwork = net;
+                    network = prepare(net);
+                }
+                else{
+                    const Network<s>* net = singleBucket ? expand(static_cast<const SingleBucketNetwork<s>*>(stored))
+                                                         : static_cast<const Network<s>*>(stored);
+                    storedNetwork = net;
+                    network = prepare(net);
+                }
+            });
+        }
 
-            assert(!stream.eof());
-            for(int i = 0; i < HIDDEN_LAYER_SIZE * 2; i++)
-                hiddenLayerWeights[i] = read_number<int16_t>(stream);
+        // Writes the active network with a header for its hidden layer size, architecture and the compiled bucket counts.
+        static bool save_network(const std::string& path){
+            return with_hidden_size(hiddenSize, [&path]<int size>(){
+                if (layered)
+                    return Sigmoid::save_network(*static_cast<const LayeredNetwork<size>*>(storedNetwork), path, mirrored);
+                return Sigmoid::save_network(*static_cast<const Network<size>*>(storedNetwork), path, mirrored);
+            });
+        }
 
-            assert(!stream.eof());
-            hiddenLayerBiases[0] = read_number<int16_t>(stream);
-            loaded = true;
+        // Drops the history and rebuilds the current accumulator with the active network.
+        void rebuild(const State& state){
+            clear_finny_table();
+            reset();
+            refresh(state);
         }
     };
 }
@@ -2,11 +2,59 @@
 #ifndef SIGMOID_NNUE_CONSTS_HPP
 #define SIGMOID_NNUE_CONSTS_HPP
 
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
 namespace Sigmoid{
     static inline constexpr int NUM_FEATURES      = 768;
-    static inline constexpr int HIDDEN_LAYER_SIZE = 128;
     static inline constexpr int OUTPUT_SIZE       = 1;
 
+    // Hidden layer sizes with prebuilt kernels, the network file header selects one of them on load.
+    static inline constexpr std::array<int, 4> HIDDEN_LAYER_SIZES = {128, 256, 512, 1024};
+    static inline constexpr int EMBEDDED_HIDDEN_LAYER_SIZE = 128;
+    // Feature transformer weights narrowed to int8 on load and widened back while accumulating (-DSIGMOID_INT8_FT).
+    // Halves the bandwidth of accumulator updates at the cost of rounding the weights to FT_WEIGHT_SHIFT.
+#ifdef SIGMOID_INT8_FT
+    static inline constexpr bool INT8_FT_WEIGHTS  = true;
+#else
+    static inline constexpr bool INT8_FT_WEIGHTS  = false;
+#endif
+    using FTWeight = std::conditional_t<INT8_FT_WEIGHTS, int8_t, int16_t>;
+
+    // int8 weights hold round(weight / 4) and are shifted back while accumulating, biases stay int16,
+    // so the accumulators keep the int16 scale. Covers -512..508, the embedded net spans -504..386.
+    template<typename Weight>
+    static inline constexpr int FT_WEIGHT_SHIFT   = sizeof(Weight) == 1 ? 2 : 0;
+
+    // Hidden layers of layered nets (feature transformer -> L1_SIZE -> L2_SIZE -> 1), picked by the file header.
+    // Their input is the feature transformer output packed to uint8 (packus), the single-layer net reads
+    // the int16 accumulators directly, so its weights are used as stored.
+    static inline constexpr int L1_SIZE           = 16;
+    static inline constexpr int L2_SIZE           = 32;
+
+    // Output heads selected by the number of pieces on the board.
+    static inline constexpr int OUTPUT_BUCKETS    = 1;
+
+    // Input weights are split by the king square of the perspective (relative, a1 = 0), NUM_FEATURES per bucket.
+    // Nets with a single bucket and head (the embedded one) are expanded to the compiled counts on load.
+    static inline constexpr int KING_BUCKETS      = 1;
+
+    // Mirrored nets (a flag of the file header) flip the board horizontally whenever the king stands on files e-h,
+    // both halves of a king bucket get their own accumulator cache entries.
+    static inline constexpr int INPUT_BUCKETS     = 2 * KING_BUCKETS;
+
+    static inline constexpr std::array<int, 64> KING_BUCKET_LAYOUT = {
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+    };
+
 }
 
 #endif //SIGMOID_NNUE_CONSTS_HPP
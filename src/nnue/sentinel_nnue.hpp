@@ -1,7 +1,7 @@
 #ifndef SIGMOID_SENTINEL_NNUE_HPP
 #define SIGMOID_SENTINEL_NNUE_HPP
 
-static const unsigned char SENTINEL_NNUE[] = {
+static constexpr unsigned char SENTINEL_NNUE[] = {
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
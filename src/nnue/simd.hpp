@@ -0,0 +1,128 @@
+#ifndef SIGMOID_SIMD_HPP
+#define SIGMOID_SIMD_HPP
+
+#include <cstdint>
+
+#if defined(__AVX512BW__) || defined(__AVX2__) || defined(__SSE4_1__)
+    #include <immintrin.h>
+#endif
+
+// Thin wrappers over the widest int16 vector instructions available for the target.
+// The ISA is selected at compile time (-march), SIGMOID_SIMD is left undefined when
+// only the scalar fallback is available.
+namespace Sigmoid::Simd{
+#if defined(__AVX512BW__)
+    #define SIGMOID_SIMD
+    using Vec = __m512i;
+    inline constexpr int REGISTER_SIZE = 64;
+
+    inline Vec load(const void* address){ return _mm512_load_si512(address); }
+    inline void store(void* address, Vec value){ _mm512_store_si512(address, value); }
+    inline Vec add_16(Vec a, Vec b){ return _mm512_add_epi16(a, b); }
+    inline Vec sub_16(Vec a, Vec b){ return _mm512_sub_epi16(a, b); }
+    inline Vec max_16(Vec a, Vec b){ return _mm512_max_epi16(a, b); }
+    inline Vec min_16(Vec a, Vec b){ return _mm512_min_epi16(a, b); }
+    inline Vec set1_16(int16_t value){ return _mm512_set1_epi16(value); }
+    inline Vec zero(){ return _mm512_setzero_si512(); }
+    inline Vec madd_16(Vec a, Vec b){ return _mm512_madd_epi16(a, b); }
+    inline Vec add_32(Vec a, Vec b){ return _mm512_add_epi32(a, b); }
+    inline Vec packus_16(Vec a, Vec b){ return _mm512_packus_epi16(a, b); }
+    template<int count> inline Vec shl_16(Vec a){ return _mm512_slli_epi16(a, count); }
+    inline Vec set1_32(int32_t value){ return _mm512_set1_epi32(value); }
+    inline uint32_t nonzero_mask_32(Vec value){ return _mm512_test_epi32_mask(value, value); }
+    // sum + 4-element dot products of unsigned a with signed b per int32, a * b pairs must fit in int16 without VNNI.
+    inline Vec dpbusd_32(Vec sum, Vec a, Vec b){
+#if defined(__AVX512VNNI__)
+        return _mm512_dpbusd_epi32(sum, a, b);
+#else
+        return _mm512_add_epi32(sum, _mm512_madd_epi16(_mm512_maddubs_epi16(a, b), _mm512_set1_epi16(1)));
+#endif
+    }
+    inline Vec load_weights(const int16_t* address){ return load(address); }
+    inline Vec load_weights(const int8_t* address){ return _mm512_cvtepi8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(address))); }
+    inline int hsum_32(Vec value){
+        // Full-mask maskz extracts, the plain ones (and _mm512_reduce_add_epi32) trip -Wmaybe-uninitialized on gcc 12.
+        const __m256i half = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF, value, 0), _mm512_maskz_extracti64x4_epi64(0xFF, value, 1));
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(sum);
+    }
+
+#elif defined(__AVX2__)
+    #define SIGMOID_SIMD
+    using Vec = __m256i;
+    inline constexpr int REGISTER_SIZE = 32;
+
+    inline Vec load(const void* address){ return _mm256_load_si256(static_cast<const Vec*>(address)); }
+    inline void store(void* address, Vec value){ _mm256_store_si256(static_cast<Vec*>(address), value); }
+    inline Vec add_16(Vec a, Vec b){ return _mm256_add_epi16(a, b); }
+    inline Vec sub_16(Vec a, Vec b){ return _mm256_sub_epi16(a, b); }
+    inline Vec max_16(Vec a, Vec b){ return _mm256_max_epi16(a, b); }
+    inline Vec min_16(Vec a, Vec b){ return _mm256_min_epi16(a, b); }
+    inline Vec set1_16(int16_t value){ return _mm256_set1_epi16(value); }
+    inline Vec zero(){ return _mm256_setzero_si256(); }
+    inline Vec madd_16(Vec a, Vec b){ return _mm256_madd_epi16(a, b); }
+    inline Vec add_32(Vec a, Vec b){ return _mm256_add_epi32(a, b); }
+    inline Vec packus_16(Vec a, Vec b){ return _mm256_packus_epi16(a, b); }
+    template<int count> inline Vec shl_16(Vec a){ return _mm256_slli_epi16(a, count); }
+    inline Vec set1_32(int32_t value){ return _mm256_set1_epi32(value); }
+    inline uint32_t nonzero_mask_32(Vec value){
+        return ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(value, _mm256_setzero_si256()))) & 0xFF;
+    }
+    inline Vec dpbusd_32(Vec sum, Vec a, Vec b){
+        return _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), _mm256_set1_epi16(1)));
+    }
+    inline Vec load_weights(const int16_t* address){ return load(address); }
+    inline Vec load_weights(const int8_t* address){ return _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(address))); }
+    inline int hsum_32(Vec value){
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(sum);
+    }
+
+#elif defined(__SSE4_1__)
+    #define SIGMOID_SIMD
+    using Vec = __m128i;
+    inline constexpr int REGISTER_SIZE = 16;
+
+    inline Vec load(const void* address){ return _mm_load_si128(static_cast<const Vec*>(address)); }
+    inline void store(void* address, Vec value){ _mm_store_si128(static_cast<Vec*>(address), value); }
+    inline Vec add_16(Vec a, Vec b){ return _mm_add_epi16(a, b); }
+    inline Vec sub_16(Vec a, Vec b){ return _mm_sub_epi16(a, b); }
+    inline Vec max_16(Vec a, Vec b){ return _mm_max_epi16(a, b); }
+    inline Vec min_16(Vec a, Vec b){ return _mm_min_epi16(a, b); }
+    inline Vec set1_16(int16_t value){ return _mm_set1_epi16(value); }
+    inline Vec zero(){ return _mm_setzero_si128(); }
+    inline Vec madd_16(Vec a, Vec b){ return _mm_madd_epi16(a, b); }
+    inline Vec add_32(Vec a, Vec b){ return _mm_add_epi32(a, b); }
+    inline Vec packus_16(Vec a, Vec b){ return _mm_packus_epi16(a, b); }
+    template<int count> inline Vec shl_16(Vec a){ return _mm_slli_epi16(a, count); }
+    inline Vec set1_32(int32_t value){ return _mm_set1_epi32(value); }
+    inline uint32_t nonzero_mask_32(Vec value){
+        return ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(value, _mm_setzero_si128()))) & 0xF;
+    }
+    inline Vec dpbusd_32(Vec sum, Vec a, Vec b){
+        return _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(a, b), _mm_set1_epi16(1)));
+    }
+    inline Vec load_weights(const int16_t* address){ return load(address); }
+    inline Vec load_weights(const int8_t* address){ return _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(address))); }
+    inline int hsum_32(Vec value){
+        value = _mm_add_epi32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2)));
+        value = _mm_add_epi32(value, _mm_shuffle_epi32(value, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(value);
+    }
+
+#else
+    inline constexpr int REGISTER_SIZE = 16;
+#endif
+
+    // Every NNUE buffer is aligned (and sized) to this, so aligned loads are always safe.
+    inline constexpr int ALIGNMENT = 64;
+    inline constexpr int INT16_PER_REGISTER = REGISTER_SIZE / sizeof(int16_t);
+    // packus works within 128-bit lanes.
+    inline constexpr int PACKUS_LANES = REGISTER_SIZE / 16;
+}
+
+#endif //SIGMOID_SIMD_HPP
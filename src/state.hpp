@@ -18,15 +18,24 @@ namespace Sigmoid{
         uint16_t halfMove = 0, fullMove = 1;
 
         uint8_t castling = 0;
+        // Both colors, kings included.
+        uint8_t pieceCount = 0;
+
+        // Squares of each color and of both, kept in sync with bitboards by set_bit and pop_bit.
+        PairBitboard occupancy;
+        uint64_t allOccupancy = 0ULL;
 
         void reset(){
             for(PairBitboard& bb : bitboards)
                 bb.clear();
 
+            occupancy.clear();
+            allOccupancy = 0ULL;
+
             for (Piece& p : pieceMap)
                 p = NONE;
 
-            zobristKey = castling = halfMove = 0;
+            zobristKey = castling = halfMove = pieceCount = 0;
             fullMove = 1;
             enPassantSquare = NO_SQUARE;
         }
@@ -34,6 +43,15 @@ namespace Sigmoid{
         template<Color color>
         void set_bit(int square, Piece piece){
             bitboards[piece].set_bit<color>(square);
+            occupancy.set_bit<color>(square);
+            set_nth_bit(allOccupancy, square);
+        }
+
+        template<Color color>
+        void pop_bit(int square, Piece piece){
+            bitboards[piece].pop_bit<color>(square);
+            occupancy.pop_bit<color>(square);
+            pop_nth_bit(allOccupancy, square);
         }
 
         template<Color color>
@@ -3,6 +3,7 @@
 
 #include "test.hpp"
 #include "../board.hpp"
+#include "../movegen.hpp"
 #include "test_helper.hpp"
 
 using namespace Sigmoid;
@@ -12,6 +13,40 @@ struct BoardTests : public Test{
         return "BoardTests";
     }
 
+    // Incrementally kept occupancy has to match the piece bitboards.
+    static void verify_occupancy(const State& state){
+        PairBitboard occupancy;
+        for (const PairBitboard& pb : state.bitboards){
+            occupancy.bitboards[WHITE] |= pb.get<WHITE>();
+            occupancy.bitboards[BLACK] |= pb.get<BLACK>();
+        }
+        throwable_assert(state.occupancy.get<WHITE>(), occupancy.get<WHITE>());
+        throwable_assert(state.occupancy.get<BLACK>(), occupancy.get<BLACK>());
+        throwable_assert(state.allOccupancy, occupancy.get<WHITE>() | occupancy.get<BLACK>());
+    }
+
+    // Random playouts through castling, en passant and promotions, checked on the way there and back.
+    static void occupancy_playout(Board& b, const std::string& fen){
+        b.load_from_fen(fen);
+        verify_occupancy(*b.currentState);
+
+        for (int i = 0; i < 64; i++){
+            std::array<Move, MAX_POSSIBLE_MOVES> moves;
+            int size = 0;
+            Movegen::generate_moves<false>(*b.currentState, b.whoPlay, moves, size);
+            if (size == 0)
+                break;
+
+            b.make_move(moves[rand() % size]);
+            verify_occupancy(*b.currentState);
+        }
+
+        while (b.ply > 0){
+            b.undo_move();
+            verify_occupancy(*b.currentState);
+        }
+    }
+
     void run() const override{
         Board b;
         b.load_from_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
@@ -33,6 +68,14 @@ struct BoardTests : public Test{
         b.load_from_fen("rnbq1rk1/ppp1bp2/5np1/3pp2p/4P2N/5PPP/PPPP3R/RNBQKB2 w Q - 1 8");
         b.print_state();
         throwable_assert<std::string>(b.get_fen() , "rnbq1rk1/ppp1bp2/5np1/3pp2p/4P2N/5PPP/PPPP3R/RNBQKB2 w Q - 1 8");
+
+        Movegen::init();
+        for (int i = 0; i < 16; i++){
+            occupancy_playout(b, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+            occupancy_playout(b, "r3k2r/pP3pp1/1N1pr1p1/4p1P1/4P3/3P4/P1P2PP1/R3K2R b KQkq - 0 4");
+            occupancy_playout(b, "rnbqkbnr/ppppp1pp/8/8/4Pp2/P1P5/1P1P1PPP/RNBQKBNR b KQkq e3 0 3");
+            occupancy_playout(b, "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1");
+        }
     }
 };
 
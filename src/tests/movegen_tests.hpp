@@ -17,19 +17,19 @@ struct MovegenTests : public Test{
         auto verify_bb = [&](uint64_t bb, Piece pc) ->void{
             int bit;
             while (bb && (bit = bit_scan_forward_pop_lsb(bb))){
-                if (board.currentState.pieceMap[bit] == pc)
+                if (board.currentState->pieceMap[bit] == pc)
                     continue;
 
                 board.print_state();
                 std::cout << depth << std::endl;
-                assert(board.currentState.pieceMap[bit] == pc);
+                assert(board.currentState->pieceMap[bit] == pc);
                 throw std::out_of_range("nah");
             }
         };
 
         int piece_cnt = 0;
         for (int i = Piece::PAWN; i <= Piece::KING; ++i){
-            const PairBitboard& pbb = board.currentState.bitboards[i];
+            const PairBitboard& pbb = board.currentState->bitboards[i];
             verify_bb(pbb.get<WHITE>(), Piece(i));
             verify_bb(pbb.get<BLACK>(), Piece(i));
 
@@ -39,7 +39,7 @@ struct MovegenTests : public Test{
 
         int non_piece_cnt = 0;
         for (int square = 0; square < 64; ++square){
-            non_piece_cnt += board.currentState.pieceMap[square] == Piece::NONE;
+            non_piece_cnt += board.currentState->pieceMap[square] == Piece::NONE;
         }
         if (non_piece_cnt + piece_cnt != 64){
             throw std::out_of_range("nah");
@@ -306,6 +306,14 @@ struct MovegenTests : public Test{
     uint64_t move_recursion(Board& board, int depth, const int maxDepth) const{
         if (depth == 0) return 1;
 
+        // Every generated move is legal, so the last ply is only counted.
+        if (!debug && depth == 1){
+            std::array<Move, MAX_POSSIBLE_MOVES> moves;
+            int size = 0;
+            Movegen::generate_moves<false>(*board.currentState, board.whoPlay, moves, size);
+            return size;
+        }
+
         [[maybe_unused]] std::string space;
         if constexpr (debug){
             std::ostringstream space_stream;
@@ -321,8 +329,7 @@ struct MovegenTests : public Test{
         Move move;
 
         while ((move = move_list.get()) != Move::none()){
-            if (!board.make_move(move))
-                continue;
+            board.make_move(move);
 
             if constexpr (debug){
                 verify_board(board, depth);
@@ -354,18 +361,13 @@ struct MovegenTests : public Test{
 
         size_t total_captures = 0;
         while ((move = move_list_non_cap.get()) != Move::none()){
-            bool cap = board.is_capture(move);
-            if (!board.make_move(move))
-                continue;
-            total_captures += cap;
-            board.undo_move();
+            total_captures += board.is_capture(move);
         }
 
         size_t gen_captures = 0;
         while ((move = move_list_cap.get()) != Move::none()){
             throwable_assert(board.is_capture(move), true);
-            if (!board.make_move(move))
-                continue;
+            board.make_move(move);
             gen_captures++;
 
             capture_move_recursion(board, depth - 1);
@@ -0,0 +1,421 @@
+#ifndef SIGMOID_NNUE_TESTS_HPP
+#define SIGMOID_NNUE_TESTS_HPP
+
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+
+#include "test.hpp"
+#include "../board.hpp"
+#include "../bencher.hpp"
+#include "test_helper.hpp"
+
+using namespace Sigmoid;
+
+struct NNUETests : public Test{
+    std::string test_name() const override{
+        return "NNUETests";
+    }
+
+    // Plain scalar forward pass of the output layer, the vectorized one has to match it exactly.
+    // Expects the current accumulator to be materialized (board.eval() called before).
+    static int16_t reference_eval(Board& board){
+        return with_hidden_size(NNUE::hiddenSize, [&board]<int size>(){
+            const InferenceNetwork<size>* network = NNUE::inference_network<size>();
+            const Color us = board.whoPlay;
+            const int16_t* our_accumulator = board.nnue.accumulator<size>(board.nnue.index, us);
+            const int16_t* opp_accumulator = board.nnue.accumulator<size>(board.nnue.index, ~us);
+            const int bucket = NNUE::output_bucket(board.currentState->pieceCount);
+
+            int eval = network->hiddenLayerBiases[bucket];
+            for (int i = 0; i < size; i++){
+                eval += network->hiddenLayerWeights[bucket][i] * NNUE::crelu(our_accumulator[i]);
+                eval += network->hiddenLayerWeights[bucket][i + size] * NNUE::crelu(opp_accumulator[i]);
+            }
+
+            eval *= NNUE::scale;
+            eval /= NNUE::qa * NNUE::qb;
+            return int16_t(eval);
+        });
+    }
+
+    // Accumulators built from scratch with the given feature transformer weights, in the natural column order.
+    template<typename Weight, int size>
+    static std::array<std::array<int16_t, size>, 2> scratch_accumulators(const FeatureTransformer<Weight, size>& transformer, const Board& board){
+        std::array<std::array<int16_t, size>, 2> accumulators = {transformer.biases, transformer.biases};
+        constexpr int shift = FT_WEIGHT_SHIFT<Weight>;
+        const State& state = *board.currentState;
+        const std::array<int, 2> king_squares = {bit_scan_forward(state.bitboards[KING].get<WHITE>()),
+                                                 bit_scan_forward(state.bitboards[KING].get<BLACK>())};
+
+        for (int square = 0; square < 64; square++){
+            const Piece piece = state.pieceMap[square];
+            if (piece == NONE)
+                continue;
+
+            const Color color = state.bitboards[piece].get<WHITE>(square) ? WHITE : BLACK;
+            const int w_index = NNUE::get_index<WHITE>(color, piece, square, king_squares[WHITE]);
+            const int b_index = NNUE::get_index<BLACK>(color, piece, square, king_squares[BLACK]);
+            for (int i = 0; i < size; i++){
+                accumulators[WHITE][i] += transformer.weights[w_index][i] * (1 << shift);
+                accumulators[BLACK][i] += transformer.weights[b_index][i] * (1 << shift);
+            }
+        }
+        return accumulators;
+    }
+
+    template<typename Weight, int size>
+    static int16_t scratch_eval(const NetworkLayout<Weight, size>& network, const Board& board){
+        const auto accumulators = scratch_accumulators(network.featureTransformer, board);
+        const Color us = board.whoPlay;
+        const int bucket = NNUE::output_bucket(board.currentState->pieceCount);
+        int eval = network.hiddenLayerBiases[bucket];
+        for (int i = 0; i < size; i++){
+            eval += network.hiddenLayerWeights[bucket][i] * NNUE::crelu(accumulators[us][i]);
+            eval += network.hiddenLayerWeights[bucket][i + size] * NNUE::crelu(accumulators[~us][i]);
+        }
+
+        eval *= NNUE::scale;
+        eval /= NNUE::qa * NNUE::qb;
+        return int16_t(eval);
+    }
+
+    // Dense scalar forward pass of a layered net in the stored (row-major) layout.
+    template<int size>
+    static int16_t scratch_layered_eval(const LayeredNetwork<size>& network, const Board& board){
+        const auto accumulators = scratch_accumulators(network.featureTransformer, board);
+        const Color us = board.whoPlay;
+        const int bucket = NNUE::output_bucket(board.currentState->pieceCount);
+
+        std::array<int, 2 * size> input;
+        for (int i = 0; i < size; i++){
+            input[i] = std::clamp<int>(accumulators[us][i], 0, Layers::ACTIVATION_MAX);
+            input[i + size] = std::clamp<int>(accumulators[~us][i], 0, Layers::ACTIVATION_MAX);
+        }
+
+        std::array<int, L1_SIZE> l1;
+        for (int o = 0; o < L1_SIZE; o++){
+            int sum = network.l1Biases[bucket][o];
+            for (int i = 0; i < 2 * size; i++)
+                sum += input[i] * network.l1Weights[bucket][o * 2 * size + i];
+            l1[o] = std::clamp(sum >> Layers::WEIGHT_SHIFT, 0, Layers::ACTIVATION_MAX);
+        }
+
+        int eval = network.outputBiases[bucket];
+        for (int o = 0; o < L2_SIZE; o++){
+            int sum = network.l2Biases[bucket][o];
+            for (int i = 0; i < L1_SIZE; i++)
+                sum += l1[i] * network.l2Weights[bucket][o * L1_SIZE + i];
+            eval += std::clamp(sum >> Layers::WEIGHT_SHIFT, 0, Layers::ACTIVATION_MAX) * network.outputWeights[bucket][o];
+        }
+
+        eval *= NNUE::scale;
+        eval /= Layers::ACTIVATION_MAX * (1 << Layers::WEIGHT_SHIFT);
+        return int16_t(eval);
+    }
+
+    // Plays a random legal move, false when there is none.
+    static bool random_move(Board& b){
+        std::array<Move, MAX_POSSIBLE_MOVES> moves;
+        int size = 0;
+        Movegen::generate_moves<false>(*b.currentState, b.whoPlay, moves, size);
+        if (size == 0)
+            return false;
+
+        b.make_move(moves[rand() % size]);
+        return true;
+    }
+
+    // Int8 feature transformer against the int16 one over the bench positions and random continuations.
+    // Lossless for a net trained on the int8 grid, the embedded int16 net only gets an error report.
+    static void int8_accuracy(Board& b){
+        constexpr int size = EMBEDDED_HIDDEN_LAYER_SIZE;
+        const Network<size>& network = *static_cast<const Network<size>*>(NNUE::storedNetwork);
+        std::unique_ptr<NetworkLayout<int8_t, size>> narrowed = std::make_unique<NetworkLayout<int8_t, size>>();
+        transform_network<false>(network, *narrowed);
+
+        std::unique_ptr<Network<size>> on_grid = std::make_unique<Network<size>>(network);
+        for (int row = 0; row < KING_BUCKETS * NUM_FEATURES; row++)
+            for (int column = 0; column < size; column++)
+                on_grid->featureTransformer.weights[row][column] = int16_t(narrowed->featureTransformer.weights[row][column] * (1 << FT_WEIGHT_SHIFT<int8_t>));
+
+        int positions = 0;
+        int64_t total_error = 0;
+        int64_t total_eval = 0;
+        int max_error = 0;
+        for (const std::string& fen : Bencher::positions){
+            b.load_from_fen(fen);
+            for (int i = 0; i < 16; i++){
+                const int16_t reference = scratch_eval(network, b);
+                const int16_t narrowed_eval = scratch_eval(*narrowed, b);
+                const int16_t engine_eval = b.eval();
+                throwable_assert(engine_eval, INT8_FT_WEIGHTS ? narrowed_eval : reference);
+                throwable_assert(scratch_eval(*on_grid, b), narrowed_eval);
+
+                const int error = std::abs(reference - narrowed_eval);
+                positions++;
+                total_error += error;
+                total_eval += std::abs(reference);
+                max_error = std::max(max_error, error);
+
+                if (!random_move(b))
+                    break;
+            }
+        }
+
+        const double mean_error = double(total_error) / positions;
+        std::cout << "int8 feature weights, " << positions << " positions: mean error " << mean_error
+                  << " cp, max error " << max_error << " cp, mean |eval| " << double(total_eval) / positions << " cp" << std::endl;
+        throwable_assert(mean_error < 64.0, true);
+    }
+
+    // Feature weights lie on the int8 grid, so both weight modes give the same evals.
+    template<int size>
+    static void randomize(FeatureTransformer<int16_t, size>& transformer){
+        for (auto& row : transformer.weights)
+            for (int16_t& weight : row)
+                weight = int16_t((rand() % 33 - 16) * (1 << FT_WEIGHT_SHIFT<int8_t>));
+        for (int16_t& bias : transformer.biases)
+            bias = int16_t(rand() % 129 - 64);
+    }
+
+    template<int size>
+    static std::unique_ptr<Network<size>> random_network(){
+        std::unique_ptr<Network<size>> network = std::make_unique<Network<size>>();
+        randomize(network->featureTransformer);
+        for (auto& weights : network->hiddenLayerWeights)
+            for (int16_t& weight : weights)
+                weight = int16_t(rand() % 33 - 16);
+        for (int16_t& bias : network->hiddenLayerBiases)
+            bias = int16_t(rand() % 1025 - 512);
+        return network;
+    }
+
+    template<int size>
+    static std::unique_ptr<LayeredNetwork<size>> random_layered_network(){
+        std::unique_ptr<LayeredNetwork<size>> network = std::make_unique<LayeredNetwork<size>>();
+        randomize(network->featureTransformer);
+        for (auto& weights : network->l1Weights)
+            for (int8_t& weight : weights)
+                weight = int8_t(rand() % 255 - 127);
+        for (auto& biases : network->l1Biases)
+            for (int32_t& bias : biases)
+                bias = rand() % 8193 - 4096;
+        for (auto& weights : network->l2Weights)
+            for (int8_t& weight : weights)
+                weight = int8_t(rand() % 255 - 127);
+        for (auto& biases : network->l2Biases)
+            for (int32_t& bias : biases)
+                bias = rand() % 8193 - 4096;
+        for (auto& weights : network->outputWeights)
+            for (int8_t& weight : weights)
+                weight = int8_t(rand() % 255 - 127);
+        for (int32_t& bias : network->outputBiases)
+            bias = rand() % 8193 - 4096;
+        return network;
+    }
+
+    // Net is saved and loaded by its header, then the loaded net is exported and loaded again with the same header.
+    template<typename NetworkType>
+    static void round_trip(const NetworkType& network, const std::string& path, bool mirrored = false){
+        throwable_assert(save_network(network, path, mirrored), true);
+        for (int i = 0; i < 2; i++){
+            throwable_assert(NNUE::load_network(path), true);
+            throwable_assert(NNUE::hiddenSize, NetworkType::HIDDEN_SIZE);
+            throwable_assert(NNUE::layered, NetworkType::LAYERED);
+            throwable_assert(NNUE::mirrored, mirrored);
+            if (i == 0)
+                throwable_assert(NNUE::save_network(path), true);
+        }
+    }
+
+    // Random net of the given hidden size, evaluated incrementally after the round trip.
+    template<int size>
+    static void hidden_size_round_trip(Board& b, const std::string& fen, const std::string& path){
+        std::unique_ptr<Network<size>> network = random_network<size>();
+        round_trip(*network, path);
+        b.load_from_fen(fen);
+
+        for (int i = 0; i < 24; i++){
+            const int16_t eval = b.eval();
+            throwable_assert(eval, reference_eval(b));
+            throwable_assert(eval, scratch_eval(*network, b));
+            if (!random_move(b))
+                break;
+        }
+    }
+
+    // Random layered net of the given hidden size, evaluated incrementally through the sparse kernels.
+    template<int size>
+    static void layered_round_trip(Board& b, const std::string& fen, const std::string& path){
+        std::unique_ptr<LayeredNetwork<size>> network = random_layered_network<size>();
+        round_trip(*network, path);
+        b.load_from_fen(fen);
+
+        for (int i = 0; i < 24; i++){
+            throwable_assert(b.eval(), scratch_layered_eval(*network, b));
+            if (!random_move(b))
+                break;
+        }
+    }
+
+    // Mirrored net: a king crossing between files d and e changes the input bucket. The walk back of
+    // materialize meets that move and refreshes the perspective from the cache entry of the new half.
+    static void mirrored_refresh(Board& b, const std::string& path){
+        std::unique_ptr<Network<EMBEDDED_HIDDEN_LAYER_SIZE>> network = random_network<EMBEDDED_HIDDEN_LAYER_SIZE>();
+        round_trip(*network, path, true);
+
+        // King on e1 takes the mirrored half, d1 the plain one, the position is not symmetric.
+        b.load_from_fen("r3k2r/pppq1ppp/2n2n2/3pp3/3PP1b1/2N2N2/PPPQ1PPP/R3KB1R w KQkq - 0 1");
+        throwable_assert(b.eval(), scratch_eval(*network, b));
+        const int e1 = 60, d1 = 59;
+        const int bucket = NNUE::input_bucket<WHITE>(d1);
+        throwable_assert(bucket != NNUE::input_bucket<WHITE>(e1), true);
+        for (const PairBitboard& bb : b.nnue.finnyBitboards[WHITE][bucket])
+            throwable_assert<uint64_t>(bb.bitboards[WHITE] | bb.bitboards[BLACK], 0);
+
+        // King move first, evaluated only after two more plies.
+        for (const std::string uci : {"e1d1", "a7a6", "a2a3"}){
+            std::array<Move, MAX_POSSIBLE_MOVES> moves;
+            int count = 0;
+            Movegen::generate_moves<false>(*b.currentState, b.whoPlay, moves, count);
+            const Move* move = std::find_if(moves.begin(), moves.begin() + count, [&uci](const Move& m){
+                return m.to_uci() == uci;
+            });
+            throwable_assert(move != moves.begin() + count, true);
+            b.make_move(*move);
+        }
+
+        throwable_assert(b.eval(), scratch_eval(*network, b));
+        for (int piece = PAWN; piece <= KING; piece++)
+            throwable_assert(b.nnue.finnyBitboards[WHITE][bucket][piece].bitboards == b.currentState->bitboards[piece].bitboards, true);
+
+        while (b.ply > 0){
+            b.undo_move();
+            throwable_assert(b.eval(), scratch_eval(*network, b));
+        }
+    }
+
+    void run() const override{
+        const std::vector<std::string> fens = {
+                "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+                "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+                "r1bq2k1/p4r1p/1pp2pp1/3p4/1P1B3Q/P2B1N2/2P3PP/4R1K1 b - - 2 19",
+                "6k1/5pp1/8/2bKP2P/2P5/p4PNb/B7/8 b - - 1 44",
+        };
+
+        Board b;
+        std::unique_ptr<Board> fresh = std::make_unique<Board>();
+        for (const std::string& fen : fens){
+            b.load_from_fen(fen);
+            int16_t eval = b.eval();
+            throwable_assert(eval, reference_eval(b));
+
+            // Random playout, evaluated only every few moves so that lazy updates replay several plies at once.
+            for (int i = 0; i < 40; i++){
+                if (!random_move(b))
+                    break;
+
+                if (rand() % 3 != 0)
+                    continue;
+
+                eval = b.eval();
+                throwable_assert(eval, reference_eval(b));
+
+                // Incrementally updated accumulator has to match the one built from scratch.
+                fresh->load_from_fen(b.get_fen());
+                throwable_assert(eval, fresh->eval());
+                throwable_assert<int>(b.currentState->pieceCount, fresh->currentState->pieceCount);
+            }
+
+            // Unwinding keeps the already computed ancestors valid.
+            while (b.ply > 0){
+                b.undo_move();
+                fresh->load_from_fen(b.get_fen());
+                throwable_assert(b.eval(), fresh->eval());
+            }
+        }
+
+        // Exported network is mapped back and used in place, corrupted files are rejected.
+        const std::string path = (std::filesystem::temp_directory_path() / "sigmoid_nnue_test.snnue").string();
+        b.load_from_fen(fens[1]);
+        const int16_t embedded_eval = b.eval();
+        throwable_assert(NNUE::save_network(path), true);
+        {
+            std::ifstream file(path, std::ios::binary);
+            std::array<char, sizeof(NetworkHeader)> header_bytes{};
+            file.read(header_bytes.data(), header_bytes.size());
+            for (size_t i = offsetof(NetworkHeader, checksum) + sizeof(uint64_t); i < header_bytes.size(); i++)
+                throwable_assert<int>(header_bytes[i], 0);
+        }
+
+        throwable_assert(NNUE::load_network(path), true);
+        throwable_assert(NNUE::storedNetwork == NNUE::networkFile.network(), true);
+        b.refresh_nnue();
+        throwable_assert(b.eval(), embedded_eval);
+
+        // Exporting over the mapped file replaces it, the pages in use stay valid.
+        throwable_assert(NNUE::save_network(path), true);
+        b.load_from_fen(fens[1]);
+        throwable_assert(b.eval(), embedded_eval);
+
+        {
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(sizeof(NetworkHeader) + 100);
+            file.put(0x55);
+        }
+        throwable_assert(NNUE::load_network(path), false);
+
+        // Hidden layer size is taken from the file header, boards are laid out again on refresh.
+        hidden_size_round_trip<256>(b, fens[1], path);
+        hidden_size_round_trip<512>(b, fens[3], path);
+        hidden_size_round_trip<1024>(b, fens[2], path);
+        hidden_size_round_trip<128>(b, fens[4], path);
+
+        // Layered nets reorder their hidden layers on load and skip the zero input chunks.
+        layered_round_trip<128>(b, fens[0], path);
+        layered_round_trip<512>(b, fens[1], path);
+        layered_round_trip<1024>(b, fens[3], path);
+
+        mirrored_refresh(b, path);
+
+        throwable_assert(NNUE::load_network(""), true);
+        throwable_assert(NNUE::networkFile.network() == nullptr, true);
+        throwable_assert(NNUE::hiddenSize, EMBEDDED_HIDDEN_LAYER_SIZE);
+        throwable_assert(NNUE::layered, false);
+        std::filesystem::remove(path);
+
+        b.load_from_fen(fens[1]);
+        fresh->load_from_fen(fens[1]);
+        throwable_assert(b.eval(), embedded_eval);
+        throwable_assert(fresh->eval(), embedded_eval);
+
+        int8_accuracy(b);
+
+        // Permuted columns packed by packus come out in the natural order.
+        constexpr int size = EMBEDDED_HIDDEN_LAYER_SIZE;
+        std::unique_ptr<Network<size>> natural = std::make_unique<Network<size>>(*static_cast<const Network<size>*>(NNUE::storedNetwork));
+        std::unique_ptr<Network<size>> permuted = std::make_unique<Network<size>>();
+        for (int column = 0; column < size; column++)
+            natural->featureTransformer.weights[0][column] = int16_t(column);
+        transform_network<true>(*natural, *permuted);
+
+        std::vector<bool> used(size, false);
+        for (int column = 0; column < size; column++)
+            used[packus_column(column)] = true;
+        throwable_assert(std::find(used.begin(), used.end(), false) == used.end(), true);
+#ifdef SIGMOID_SIMD
+        const int16_t* row = permuted->featureTransformer.weights[0].data();
+        for (int i = 0; i < size; i += 2 * Simd::INT16_PER_REGISTER){
+            alignas(Simd::ALIGNMENT) std::array<uint8_t, Simd::REGISTER_SIZE> packed;
+            Simd::store(packed.data(), Simd::packus_16(Simd::load(row + i), Simd::load(row + i + Simd::INT16_PER_REGISTER)));
+            for (int k = 0; k < Simd::REGISTER_SIZE; k++)
+                throwable_assert<int>(packed[k], i + k);
+        }
+#endif
+    }
+};
+
+#endif //SIGMOID_NNUE_TESTS_HPP
@@ -13,6 +13,8 @@
 #include "movegen_tests.hpp"
 #include "zobrist_tests.hpp"
 #include "see_tests.hpp"
+#include "tt_tests.hpp"
+#include "nnue_tests.hpp"
 
 // No lib used for tests.
 // Most of the tests are just sanity checks.
@@ -27,6 +29,8 @@ struct TestRunner{
         tests.push_back(std::make_unique<PairBitboardTests>());
         tests.push_back(std::make_unique<BoardTests>());
         tests.push_back(std::make_unique<ZobristTests>());
+        tests.push_back(std::make_unique<TTTests>());
+        tests.push_back(std::make_unique<NNUETests>());
         tests.push_back(std::make_unique<MovegenTests>());
 
         Zobrist::init();
@@ -0,0 +1,121 @@
+#ifndef SIGMOID_TT_TESTS_HPP
+#define SIGMOID_TT_TESTS_HPP
+
+#include <vector>
+#include <fstream>
+#include <filesystem>
+
+#include "test.hpp"
+#include "../tt.hpp"
+#include "test_helper.hpp"
+
+using namespace Sigmoid;
+
+struct TTTests : public Test{
+    std::string test_name() const override{
+        return "TTTests";
+    }
+
+    void run() const override{
+        TranspositionTable tt;
+        tt.resize(1);
+        tt.new_search();
+
+        const uint64_t key = 0x123456789abcdef0ULL;
+        tt.store(key, Move(12, 28), EXACT, 7, 35, -20, 0);
+
+        auto [entry, tt_hit] = tt.probe(key, 0);
+        throwable_assert(tt_hit, true);
+        throwable_assert(entry.move == Move(12, 28), true);
+        throwable_assert<int>(entry.flag(), EXACT);
+        throwable_assert<int>(entry.depth, 7);
+        throwable_assert<int>(entry.eval, 35);
+        throwable_assert<int>(entry.staticEval, -20);
+
+        throwable_assert(tt.probe(key ^ 1ULL, 0).second, false);
+
+        // Keys sharing the cluster with the first one.
+        std::vector<uint64_t> keys;
+        uint64_t candidate = key;
+        while (keys.size() < Cluster::SIZE){
+            candidate = candidate * 6364136223846793005ULL + 1442695040888963407ULL;
+            if (tt.get_index(candidate) == tt.get_index(key) && candidate != key)
+                keys.push_back(candidate);
+        }
+
+        // Older entry has to be replaced, even though it is a bit deeper.
+        tt.new_search();
+        for (int i = 0; i < Cluster::SIZE - 1; i++)
+            tt.store(keys[i], Move(1, 2), LOWER_BOUND, 6, 0, 0, 0);
+
+        tt.new_search();
+        const uint64_t new_key = keys[Cluster::SIZE - 1];
+        tt.store(new_key, Move(3, 4), UPPER_BOUND, 1, 0, 0, 0);
+
+        throwable_assert(tt.probe(new_key, 0).second, true);
+        throwable_assert(tt.probe(key, 0).second, false);
+
+        // Shallow entries are routed to the hot table, deep ones stay in the main table.
+        tt.resize_hot(1);
+        throwable_assert<size_t>(tt.hot->numberOfClusters, 1024 / sizeof(Cluster));
+        tt.store(key, Move(5, 6), LOWER_BOUND, 1, 10, 0, 0);
+        tt.store(new_key, Move(7, 8), LOWER_BOUND, 9, 20, 0, 0);
+
+        TTStats stats;
+        throwable_assert(tt.probe(key, 1, &stats).first.move == Move(5, 6), true);
+        throwable_assert(tt.probe(new_key, 9, &stats).first.move == Move(7, 8), true);
+        throwable_assert<uint64_t>(stats.hits[HOT_TIER], 1);
+        throwable_assert<uint64_t>(stats.hits[MAIN_TIER], 1);
+
+        // Deep probe falls back to the hot table.
+        throwable_assert(tt.probe(key, 9, &stats).second, true);
+        throwable_assert<uint64_t>(stats.probes[MAIN_TIER], 2);
+        throwable_assert(stats.hit_rate(MAIN_TIER), 50.0);
+        throwable_assert(TTStats().hit_rate(HOT_TIER), 0.0);
+
+        // Rehash moves the main table only, the hot table keeps its entries and both stay in one generation.
+        tt.rehash(2);
+        throwable_assert(tt.probe(key, 1).first.move == Move(5, 6), true);
+        throwable_assert(tt.probe(new_key, 9).first.move == Move(7, 8), true);
+        throwable_assert<int>(tt.hot->generation, tt.generation);
+
+        // Saved table maps back with its entries, header padding is written as zeros.
+        const std::string path = (std::filesystem::temp_directory_path() / "sigmoid_tt_test.stt").string();
+        throwable_assert(tt.save(path), true);
+        {
+            std::ifstream file(path, std::ios::binary);
+            std::array<char, sizeof(TranspositionTable::FileHeader)> header_bytes{};
+            file.read(header_bytes.data(), header_bytes.size());
+            for (size_t i = offsetof(TranspositionTable::FileHeader, generation) + 1; i < header_bytes.size(); i++)
+                throwable_assert<int>(header_bytes[i], 0);
+        }
+
+        TranspositionTable loaded;
+        throwable_assert(loaded.load(path), true);
+        throwable_assert(loaded.probe(new_key, 9).first.move == Move(7, 8), true);
+
+        // Saving over the file it is mapped from keeps the mapping readable, pages not touched yet included.
+        const size_t file_size = std::filesystem::file_size(path);
+        throwable_assert(loaded.save(path), true);
+        throwable_assert<size_t>(std::filesystem::file_size(path), file_size);
+        for (uint64_t probe_key = 0; probe_key < 4096; probe_key++)
+            loaded.probe(probe_key * 0x9e3779b97f4a7c15ULL, 0);
+        throwable_assert(loaded.probe(new_key, 9).first.move == Move(7, 8), true);
+
+        TranspositionTable reloaded;
+        throwable_assert(reloaded.load(path), true);
+        throwable_assert(reloaded.probe(new_key, 9).first.move == Move(7, 8), true);
+
+        // Header whose cluster count overflows the size computation is rejected.
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            TranspositionTable::FileHeader header;
+            header.numberOfClusters = 1ULL << 58;
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+        throwable_assert(reloaded.load(path), false);
+        std::filesystem::remove(path);
+    }
+};
+
+#endif //SIGMOID_TT_TESTS_HPP
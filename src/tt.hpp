@@ -1,77 +1,508 @@
 #include <cstdint>
 #include <cstring>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <algorithm>
+
+#include <string>
 
 #include "move.hpp"
+#include "bitops.hpp"
+#include "mapped_file.hpp"
 
 #ifndef SIGMOID_TT_HPP
 #define SIGMOID_TT_HPP
 
 namespace Sigmoid {
     enum TTFlag : int8_t {
+        NO_BOUND = 0,
         LOWER_BOUND = 1,
         UPPER_BOUND = 2,
         EXACT = 3
     };
 
+    // [generation - 6b][flag - 2b] are packed into one byte.
     struct Entry {
-        uint32_t key = 0;
         Move move = Move::none();
-        TTFlag flag;
-        int8_t depth = 0;
         int16_t eval = 0;
+        int16_t staticEval = NO_EVAL;
+        int8_t depth = 0;
+        uint8_t genFlag = 0;
+
+        [[nodiscard]] TTFlag flag() const{
+            return TTFlag(genFlag & FLAG_MASK);
+        }
+
+        [[nodiscard]] uint8_t generation() const{
+            return genFlag & GENERATION_MASK;
+        }
+
+        // [staticEval - 16b][genFlag - 8b][depth - 8b][eval - 16b][move - 16b]
+        [[nodiscard]] uint64_t pack() const{
+            return uint64_t(move.data)
+                 | uint64_t(uint16_t(eval)) << 16
+                 | uint64_t(uint8_t(depth)) << 32
+                 | uint64_t(genFlag) << 40
+                 | uint64_t(uint16_t(staticEval)) << 48;
+        }
+
+        static Entry unpack(uint64_t data){
+            Entry entry;
+            entry.move.data = uint16_t(data);
+            entry.eval = int16_t(data >> 16);
+            entry.depth = int8_t(data >> 32);
+            entry.genFlag = uint8_t(data >> 40);
+            entry.staticEval = int16_t(data >> 48);
+            return entry;
+        }
+
+        static inline constexpr uint8_t FLAG_MASK = 0x3;
+        static inline constexpr uint8_t GENERATION_MASK = 0xFC;
+        static inline constexpr uint8_t GENERATION_STEP = 0x4;
+    };
+
+    // Shared by all threads without locking.
+    // Key is stored xor-ed with data, so an entry torn by a concurrent write fails the key check
+    // instead of returning a move and a score of two different positions.
+    struct PackedEntry {
+        uint64_t key = 0ULL;
+        uint64_t data = 0ULL;
+
+        [[nodiscard]] uint64_t load_key(){
+            return std::atomic_ref<uint64_t>(key).load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] uint64_t load_data(){
+            return std::atomic_ref<uint64_t>(data).load(std::memory_order_relaxed);
+        }
+
+        void save(uint64_t zobristKey, uint64_t newData){
+            std::atomic_ref<uint64_t>(key).store(zobristKey ^ newData, std::memory_order_relaxed);
+            std::atomic_ref<uint64_t>(data).store(newData, std::memory_order_relaxed);
+        }
+    };
+
+    // Entries of one bucket share a single cache line, so a probe costs one memory access.
+    struct alignas(64) Cluster {
+        static inline constexpr int SIZE = 4;
+        std::array<PackedEntry, SIZE> entries;
+    };
+
+    static_assert(sizeof(PackedEntry) == 16);
+    static_assert(sizeof(Cluster) == 64);
+
+    enum TTTier {
+        MAIN_TIER,
+        HOT_TIER
+    };
+
+    // Owned by a single search thread, aligned so counters of different threads never share a cache line.
+    // Overwrite - entry of the same position was rewritten, collision - entry of another position was evicted.
+    struct alignas(64) TTStats {
+        std::array<uint64_t, 2> probes = {};
+        std::array<uint64_t, 2> hits = {};
+        uint64_t stores = 0;
+        uint64_t overwrites = 0;
+        uint64_t collisions = 0;
+
+        void add(const TTStats& other){
+            for (int tier : {MAIN_TIER, HOT_TIER}){
+                probes[tier] += other.probes[tier];
+                hits[tier] += other.hits[tier];
+            }
+            stores += other.stores;
+            overwrites += other.overwrites;
+            collisions += other.collisions;
+        }
+
+        // Percentage of probes of the tier that found their position, 0 before the first probe.
+        [[nodiscard]] double hit_rate(TTTier tier) const{
+            return probes[tier] ? (hits[tier] * 100.0) / probes[tier] : 0.0;
+        }
     };
 
     struct TranspositionTable {
-        size_t numberOfEntries;
-        Entry* entries = nullptr;
+        // Entries up to this depth go to the hot table, if it is enabled.
+        static inline constexpr int HOT_MAX_DEPTH = 2;
+
+        size_t numberOfClusters = 0;
+        Cluster* clusters = nullptr;
+        uint8_t generation = 0;
+
+        TranspositionTable() = default;
+        TranspositionTable(const TranspositionTable&) = delete;
+        TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+        // Small table for shallow entries, which should stay in L2 and keep the leaves from evicting deep entries.
+        std::unique_ptr<TranspositionTable> hot;
+
+        void resize(size_t sizeMB, int threadCnt = 1) {
+            allocate(sizeMB);
+            clear(threadCnt);
+        }
+
+        // Sized in KB, so that the table can be made small enough for L2. 0 disables the hot table.
+        void resize_hot(size_t sizeKB){
+            if (sizeKB == 0){
+                hot.reset();
+                return;
+            }
+
+            if (!hot)
+                hot = std::make_unique<TranspositionTable>();
+            hot->allocate_clusters(std::max<size_t>((sizeKB * 1024) / sizeof(Cluster), 1));
+            hot->clear();
+            hot->generation = generation;
+        }
+
+        bool allocate(size_t sizeMB){
+            return allocate_clusters((sizeMB * 1024 * 1024) / sizeof(Cluster));
+        }
+
+        // Returns false, if the table already has requested size and nothing was allocated.
+        bool allocate_clusters(size_t clusterCount){
+            if (clusters && clusterCount == numberOfClusters)
+                return false;
+
+            release();
+            numberOfClusters = clusterCount;
+            const size_t bytes = round_up(numberOfClusters * sizeof(Cluster), HUGE_PAGE_SIZE);
+
+#if defined(__linux__)
+            // Explicit huge pages, if some are reserved by the system.
+            void* huge_pages = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (huge_pages != MAP_FAILED){
+                storage = {huge_pages, bytes, true};
+                clusters = static_cast<Cluster*>(storage.memory);
+                return true;
+            }
+#endif
+            storage = {std::aligned_alloc(HUGE_PAGE_SIZE, bytes), bytes, false};
+            if (!storage.memory)
+                throw std::bad_alloc();
+            clusters = static_cast<Cluster*>(storage.memory);
+#if defined(__linux__)
+            // Otherwise transparent huge pages, to reduce TLB misses of random accesses.
+            madvise(storage.memory, bytes, MADV_HUGEPAGE);
+#endif
+            return true;
+        }
+
+        void clear(int threadCnt = 1){
+            if (hot)
+                hot->clear();
+
+            generation = 0;
+            clear_clusters(threadCnt);
+        }
+
+        // Every thread clears its own part of the table, first touch also spreads pages over NUMA nodes.
+        // Generation and the hot table are left as they are.
+        void clear_clusters(int threadCnt = 1){
+            parallel_for(threadCnt, numberOfClusters, [this](size_t start, size_t end){
+                std::memset(static_cast<void*>(clusters + start), 0, (end - start) * sizeof(Cluster));
+            });
+        }
+
+        // Resize, which keeps the search knowledge - entries of the old table are inserted into the new one.
+        void rehash(size_t sizeMB, int threadCnt = 1){
+            if (!clusters){
+                resize(sizeMB, threadCnt);
+                return;
+            }
+
+            const size_t new_clusters = (sizeMB * 1024 * 1024) / sizeof(Cluster);
+            if (new_clusters == numberOfClusters)
+                return;
+
+            TranspositionTable old;
+            swap_memory(old);
 
-        void resize(int sizeMB) {
-            delete[] entries;
+            allocate(sizeMB);
+            clear_clusters(threadCnt);
 
-            numberOfEntries = (sizeMB * 1024 * 1024) / sizeof(Entry);
-            entries = new Entry[numberOfEntries];
-            clear();
+            parallel_for(threadCnt, old.numberOfClusters, [this, &old](size_t start, size_t end){
+                for (size_t i = start; i < end; i++){
+                    for (PackedEntry& packed : old.clusters[i].entries){
+                        const uint64_t data = packed.load_data();
+                        const Entry entry = Entry::unpack(data);
+                        if (entry.flag() != NO_BOUND)
+                            insert(packed.load_key() ^ data, entry);
+                    }
+                }
+            });
         }
 
-        void clear(){
-            std::fill(entries, entries + numberOfEntries, Entry{});
+        // File layout: [FileHeader][clusters], header keeps clusters aligned to a cache line.
+        struct alignas(64) FileHeader {
+            std::array<char, 8> magic = FILE_MAGIC;
+            uint32_t version = FILE_VERSION;
+            uint32_t clusterSize = sizeof(Cluster);
+            uint64_t numberOfClusters = 0;
+            uint8_t generation = 0;
+        };
+
+        static inline constexpr std::array<char, 8> FILE_MAGIC = {'S', 'I', 'G', 'M', 'O', 'I', 'D', 'T'};
+        static inline constexpr uint32_t FILE_VERSION = 1;
+
+        bool save(const std::string& path){
+            return save_file<FileHeader>(path, [this](FileHeader& header){
+                header.numberOfClusters = numberOfClusters;
+                header.generation = generation;
+            }, clusters, numberOfClusters * sizeof(Cluster));
+        }
+
+        // Saved table is mapped copy-on-write, so loading does not depend on the table size
+        // and the file is never modified. Current table is kept, if the file is not valid.
+        bool load(const std::string& path){
+            FileHeader header;
+            MappedMemory file = map_file(path, true, header, is_valid);
+            if (!file.memory)
+                return false;
+
+            release();
+            storage = file;
+            clusters = reinterpret_cast<Cluster*>(static_cast<char*>(storage.memory) + sizeof(FileHeader));
+            numberOfClusters = header.numberOfClusters;
+            generation = header.generation;
+            if (hot)
+                hot->generation = generation;
+            return true;
+        }
+
+        [[nodiscard]] size_t size_mb() const{
+            return (numberOfClusters * sizeof(Cluster)) / (1024 * 1024);
         }
 
-        inline uint32_t entry_key(uint64_t key){
-            return uint32_t(key >> 32);
+        // Called before every search, older entries become preferred victims of the replacement.
+        void new_search(){
+            generation += Entry::GENERATION_STEP;
+            if (hot)
+                hot->new_search();
         }
 
-        void store(uint64_t key, const Move& move, TTFlag flag, int8_t depth, int16_t eval, int16_t ply){
+        void store(uint64_t key, const Move& move, TTFlag flag, int8_t depth, int16_t eval, int16_t staticEval, int16_t ply,
+                   TTStats* stats = nullptr){
             if (eval >= CHECKMATE_BOUND) eval += ply;
             else if (eval <= -CHECKMATE_BOUND) eval -= ply;
-            const int index = get_index(key);
-            Entry& entry = entries[index];
 
-            uint32_t e_key = entry_key(key);
+            TranspositionTable& table = hot && depth <= HOT_MAX_DEPTH ? *hot : *this;
+            table.store_entry(key, move, flag, depth, eval, staticEval, stats);
+        }
 
-            if (entry.key != e_key || depth > entry.depth || flag == EXACT)
-                entry = {e_key, move, flag, depth, eval};
+        // Permille of the entries written in the current search, sampled from the beginning of the table.
+        [[nodiscard]] int hashfull(){
+            const size_t sample = std::min<size_t>(HASHFULL_SAMPLE / Cluster::SIZE, numberOfClusters);
+            int used = 0;
+            for (size_t i = 0; i < sample; i++){
+                for (PackedEntry& packed : clusters[i].entries){
+                    const Entry entry = Entry::unpack(packed.load_data());
+                    used += entry.flag() != NO_BOUND && entry.generation() == generation;
+                }
+            }
+            return sample ? (used * 1000) / int(sample * Cluster::SIZE) : 0;
         }
 
         void prefetch(uint64_t key){
-            __builtin_prefetch(&entries[get_index(key)]);
+            __builtin_prefetch(&clusters[get_index(key)]);
         }
 
-        std::pair<Entry, bool> probe(uint64_t key){
-            const int index = get_index(key);
-            Entry entry = entries[index];
+        // Shallow nodes look into the hot table first, deep ones into the main table.
+        std::pair<Entry, bool> probe(uint64_t key, int depth, TTStats* stats = nullptr){
+            if (!hot)
+                return probe_tier(*this, MAIN_TIER, key, stats);
+
+            const TTTier first = depth <= HOT_MAX_DEPTH ? HOT_TIER : MAIN_TIER;
+            const TTTier second = first == HOT_TIER ? MAIN_TIER : HOT_TIER;
 
-            const bool tt_hit = entries[index].key == entry_key(key);
-            entry.move = tt_hit ? entry.move : Move::none();
-            return {entry, tt_hit};
+            auto result = probe_tier(tier_table(first), first, key, stats);
+            if (result.second)
+                return result;
+            return probe_tier(tier_table(second), second, key, stats);
         }
 
-        inline int get_index(const uint64_t& key){
-            return int(key % numberOfEntries);
+        // Maps key uniformly onto [0, numberOfClusters) without a division.
+        inline size_t get_index(const uint64_t& key){
+            return mul_hi64(key, numberOfClusters);
         }
 
         ~TranspositionTable(){
-            delete[] entries;
+            release();
+        }
+
+    private:
+        static inline constexpr int HASHFULL_SAMPLE = 1000;
+
+        void store_entry(uint64_t key, const Move& move, TTFlag flag, int8_t depth, int16_t eval, int16_t staticEval,
+                         TTStats* stats){
+            Cluster& cluster = clusters[get_index(key)];
+
+            // Same position or an empty slot is used first, otherwise the shallowest and oldest entry is replaced.
+            PackedEntry* replace = &cluster.entries[0];
+            Entry old = Entry::unpack(replace->load_data());
+            bool same_key = false;
+            for (PackedEntry& packed : cluster.entries){
+                const uint64_t data = packed.load_data();
+                const Entry entry = Entry::unpack(data);
+                same_key = (packed.load_key() ^ data) == key;
+
+                if (same_key || entry.flag() == NO_BOUND){
+                    replace = &packed;
+                    old = entry;
+                    break;
+                }
+
+                if (replace_value(entry) < replace_value(old)){
+                    replace = &packed;
+                    old = entry;
+                }
+            }
+
+            if (stats){
+                stats->stores++;
+                stats->overwrites += same_key;
+                stats->collisions += !same_key && old.flag() != NO_BOUND;
+            }
+
+            if (same_key && depth + 2 <= old.depth && flag != EXACT && old.generation() == generation){
+                if (move == Move::none() || move == old.move)
+                    return;
+
+                old.move = move;
+                replace->save(key, old.pack());
+                return;
+            }
+
+            Entry entry;
+            entry.move = same_key && move == Move::none() ? old.move : move;
+            entry.eval = eval;
+            entry.staticEval = staticEval;
+            entry.depth = depth;
+            entry.genFlag = generation | flag;
+            replace->save(key, entry.pack());
+        }
+
+        std::pair<Entry, bool> probe_entry(uint64_t key){
+            Cluster& cluster = clusters[get_index(key)];
+
+            for (PackedEntry& packed : cluster.entries){
+                const uint64_t data = packed.load_data();
+                if ((packed.load_key() ^ data) != key)
+                    continue;
+
+                Entry entry = Entry::unpack(data);
+                if (entry.flag() == NO_BOUND)
+                    continue;
+
+                // Refresh, so entry used in this search is not replaced as an old one.
+                if (entry.generation() != generation){
+                    entry.genFlag = generation | entry.flag();
+                    packed.save(key, entry.pack());
+                }
+                return {entry, true};
+            }
+            return {Entry{}, false};
+        }
+
+        TranspositionTable& tier_table(TTTier tier){
+            return tier == HOT_TIER ? *hot : *this;
+        }
+
+        static std::pair<Entry, bool> probe_tier(TranspositionTable& table, TTTier tier, uint64_t key, TTStats* stats){
+            auto result = table.probe_entry(key);
+            if (stats){
+                stats->probes[tier]++;
+                stats->hits[tier] += result.second;
+            }
+            return result;
+        }
+
+        static inline constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+        MappedMemory storage;
+
+        template<typename Function>
+        static void parallel_for(int threadCnt, size_t size, const Function& function){
+            threadCnt = std::max(threadCnt, 1);
+            const size_t chunk = size / threadCnt;
+
+            std::vector<std::thread> threads;
+            for (int i = 0; i < threadCnt; i++){
+                const size_t start = i * chunk;
+                const size_t end = i == threadCnt - 1 ? size : start + chunk;
+                threads.emplace_back(function, start, end);
+            }
+
+            for (std::thread& thread : threads)
+                thread.join();
+        }
+
+        void swap_memory(TranspositionTable& other){
+            std::swap(numberOfClusters, other.numberOfClusters);
+            std::swap(clusters, other.clusters);
+            std::swap(storage, other.storage);
+        }
+
+        // Used by rehash, entry is kept only if it is more valuable than the one it would replace.
+        void insert(uint64_t key, const Entry& entry){
+            Cluster& cluster = clusters[get_index(key)];
+
+            PackedEntry* replace = &cluster.entries[0];
+            Entry old = Entry::unpack(replace->load_data());
+            for (PackedEntry& packed : cluster.entries){
+                const uint64_t data = packed.load_data();
+                const Entry current = Entry::unpack(data);
+
+                if (current.flag() == NO_BOUND || (packed.load_key() ^ data) == key){
+                    replace = &packed;
+                    old = current;
+                    break;
+                }
+
+                if (replace_value(current) < replace_value(old)){
+                    replace = &packed;
+                    old = current;
+                }
+            }
+
+            if (old.flag() == NO_BOUND || replace_value(entry) > replace_value(old))
+                replace->save(key, entry.pack());
+        }
+
+        // Cluster count is checked by division, a forged count cannot overflow into a matching size.
+        static bool is_valid(const FileHeader& header, size_t fileSize){
+            return header.magic == FILE_MAGIC
+                   && header.version == FILE_VERSION
+                   && header.clusterSize == sizeof(Cluster)
+                   && header.numberOfClusters > 0
+                   && fileSize > sizeof(FileHeader)
+                   && (fileSize - sizeof(FileHeader)) % sizeof(Cluster) == 0
+                   && header.numberOfClusters == (fileSize - sizeof(FileHeader)) / sizeof(Cluster);
+        }
+
+        static size_t round_up(size_t value, size_t multiple){
+            return (value + multiple - 1) / multiple * multiple;
+        }
+
+        void release(){
+            storage.release();
+            clusters = nullptr;
+        }
+
+        static inline constexpr int AGE_WEIGHT = 2;
+
+        // Generation is 6 bits wide, so age wraps around cleanly after 64 searches.
+        [[nodiscard]] int relative_age(const Entry& entry) const{
+            return ((generation - entry.generation()) & Entry::GENERATION_MASK) / Entry::GENERATION_STEP;
+        }
+
+        [[nodiscard]] int replace_value(const Entry& entry) const{
+            return entry.depth - AGE_WEIGHT * relative_age(entry);
         }
     };
 }
@@ -1,6 +1,8 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <chrono>
+#include <thread>
 
 #include "constants.hpp"
 #include "movegen.hpp"
@@ -15,36 +17,61 @@
 namespace Sigmoid{
     struct Uci{
         static inline const std::string START_POS = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
-        int ttSize = 16;
+        size_t ttSize = 16;
         Board board;
         Engine engine;
         TranspositionTable tt;
         int threadCnt = 1;
+        bool backgroundHashResize = true;
+        std::thread ttResizeThread;
+        int64_t ttResizeMs = 0;
+        bool keepLoadedTT = false;
+        std::string evalFile = "<empty>";
 
         Uci() {
-            tt = TranspositionTable();
             tt.resize(ttSize);
             board.load_from_fen(START_POS);
             engine.new_game(threadCnt);
         }
 
+        ~Uci(){
+            wait_for_tt();
+        }
+
         void loop(){
             std::string line;
             while((std::getline(std::cin, line))){
                 if (line == "quit")
                     break;
+                if (line.rfind("savehash", 0) == 0){
+                    command_save_hash(line);
+                    continue;
+                }
+                if (line.rfind("loadhash", 0) == 0){
+                    command_load_hash(line);
+                    continue;
+                }
+                if (line.rfind("exportnet", 0) == 0){
+                    command_export_net(line);
+                    continue;
+                }
+                // Option values (paths) may contain other command names.
+                if (line.rfind("setoption", 0) == 0){
+                    command_set_option(line);
+                    continue;
+                }
                 if (line == "uci")
                     command_uci();
                 if (line == "isready")
                     command_is_ready();
+                if (line == "hashstats")
+                    command_hash_stats();
                 if (line == "ucinewgame")
                     command_uci_new_game();
                 if (line.find("position") != std::string::npos)
                     command_position(line);
                 if (line.find("go") != std::string::npos)
                     command_go(line);
-                if (line.find("setoption") != std::string::npos)
-                    command_set_option(line);
                 if (line.find("eval") != std::string::npos){
                     board.print_state();
                     std::cout << board.eval() << std::endl;
@@ -57,10 +84,19 @@ namespace Sigmoid{
             std::string type, value;
             stream >> type >> type >> type >> value >> value;
 
+            wait_for_tt();
+            if (type == "EvalFile"){
+                const size_t value_pos = command.find(" value ");
+                set_eval_file(value_pos == std::string::npos ? "" : command.substr(value_pos + 7));
+            }
             if(type == "Hash"){
-                ttSize = std::stoi(value);
-                tt.resize(ttSize);
+                ttSize = std::stoull(value);
+                resize_tt();
             }
+            if (type == "HotHashKB")
+                tt.resize_hot(std::stoull(value));
+            if (type == "BackgroundHashResize")
+                backgroundHashResize = value == "true";
             if (type == "Threads") {
                 threadCnt = std::stoi(value);
                 engine.new_game(threadCnt);
@@ -82,6 +118,7 @@ namespace Sigmoid{
                 >> tmp >> options.bTime >> tmp >> options.wInc >> tmp >> options.bInc;
             }
 
+            wait_for_tt();
             options.board = board;
             options.tt = &tt;
             engine.start_searching(options);
@@ -118,36 +155,175 @@ namespace Sigmoid{
                 Move move;
 
                 while ((move = mp.get()) != Move::none()){
-                    if (move.to_uci().find(str_move) == std::string::npos)
-                        continue;
+                    if (move.to_uci().find(str_move) != std::string::npos)
+                        break;
+                }
 
-                    if (!board.make_move(move))
-                        std::cout << "Illegal move.";
-                    break;
+                // Later moves would be applied to a wrong position, the position is kept before the illegal one.
+                if (move == Move::none()){
+                    std::cout << "info string illegal move " << str_move << ", ignoring it and the moves after it" << std::endl;
+                    return;
                 }
+
+                board.make_move(move);
             }
         }
 
+        // Network is mapped and validated, the previous one stays active if that fails.
+        void set_eval_file(const std::string& path){
+            auto start = std::chrono::high_resolution_clock::now();
+            if (!NNUE::load_network(path)){
+                std::cout << "info string network could not be loaded from " << path << ", using " << evalFile << std::endl;
+                return;
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+
+            evalFile = path.empty() ? "<empty>" : path;
+            board.refresh_nnue();
+            std::cout << "info string network " << (evalFile == "<empty>" ? "embedded" : evalFile) << " loaded in "
+                      << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us" << std::endl;
+        }
+
+        // exportnet <path>
+        // Writes the active network with its header, the file can be used as EvalFile.
+        void command_export_net(const std::string& command){
+            const std::string path = command.substr(std::string("exportnet").size() + 1);
+            if (NNUE::save_network(path))
+                std::cout << "info string network saved to " << path << std::endl;
+            else
+                std::cout << "info string network could not be saved to " << path << std::endl;
+        }
+
+        // savehash <path>
+        void command_save_hash(const std::string& command){
+            const std::string path = command.substr(std::string("savehash").size() + 1);
+            wait_for_tt();
+            auto start = std::chrono::high_resolution_clock::now();
+            const bool saved = tt.save(path);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            if (saved)
+                std::cout << "info string hash saved to " << path << " in "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << std::endl;
+            else
+                std::cout << "info string hash could not be saved to " << path << std::endl;
+        }
+
+        // loadhash <path>
+        // Hash option is set to the size of the loaded table, the next ucinewgame does not clear it.
+        void command_load_hash(const std::string& command){
+            const std::string path = command.substr(std::string("loadhash").size() + 1);
+            wait_for_tt();
+            auto start = std::chrono::high_resolution_clock::now();
+            const bool loaded = tt.load(path);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            if (!loaded){
+                std::cout << "info string hash could not be loaded from " << path << std::endl;
+                return;
+            }
+
+            ttSize = tt.size_mb();
+            keepLoadedTT = true;
+            std::cout << "info string hash " << ttSize << " MB loaded from " << path << " in "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << std::endl;
+        }
+
+        void command_hash_stats(){
+            wait_for_tt();
+            const TTStats stats = engine.tt_stats();
+
+            auto print_tier = [&stats](const std::string& name, TTTier tier){
+                std::cout << "info string " << name << " probes " << stats.probes[tier] << " hits " << stats.hits[tier]
+                          << " hitrate " << stats.hit_rate(tier) << "%" << std::endl;
+            };
+
+            std::cout << "info string hashfull " << tt.hashfull() << std::endl;
+            print_tier("main", MAIN_TIER);
+            if (tt.hot)
+                print_tier("hot", HOT_TIER);
+            std::cout << "info string stores " << stats.stores << " overwrites " << stats.overwrites
+                      << " collisions " << stats.collisions << std::endl;
+        }
+
         void command_uci(){
             std::cout << "id name Sigmoid " << VERSION << std::endl;
             std::cout << "id author Daniel Samek" << std::endl;
 
-            std::cout << "option name Hash type spin default " << ttSize << " min 1 max 128000" << std::endl;
+            std::cout << "option name Hash type spin default " << ttSize << " min 1 max 1048576" << std::endl;
             std::cout << "option name Threads type spin default 1 min 1 max 1024" << std::endl;
+            std::cout << "option name HotHashKB type spin default 0 min 0 max 65536" << std::endl;
+            std::cout << "option name BackgroundHashResize type check default true" << std::endl;
+            std::cout << "option name EvalFile type string default <empty>" << std::endl;
             std::cout << "uciok" << std::endl;
         }
 
         void command_is_ready(){
+            wait_for_tt();
             Zobrist::init();
             Movegen::init();
             std::cout << "readyok" << std::endl;
         }
 
+        // Table loaded by loadhash is meant for the game that follows, so the first new game after it keeps it.
         void command_uci_new_game(){
             board.load_from_fen(START_POS);
-            tt.resize(ttSize);
+            wait_for_tt();
+            if (keepLoadedTT){
+                keepLoadedTT = false;
+                std::cout << "info string hash " << ttSize << " MB kept from loadhash" << std::endl;
+            }
+            else
+                prepare_tt();
             engine.new_game(threadCnt);
         }
+
+        // Entries are moved to the new table, the UCI loop continues meanwhile if the resize runs in the background.
+        // Every command using the table waits for it. The resize itself never prints, only the UCI thread writes to stdout.
+        void resize_tt(){
+            auto resize = [this](){
+                auto start = std::chrono::high_resolution_clock::now();
+                tt.rehash(ttSize, threadCnt);
+                auto end = std::chrono::high_resolution_clock::now();
+                ttResizeMs = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+            };
+
+            if (backgroundHashResize)
+                ttResizeThread = std::thread(resize);
+            else{
+                resize();
+                print_tt_resize();
+            }
+        }
+
+        void wait_for_tt(){
+            if (ttResizeThread.joinable()){
+                ttResizeThread.join();
+                print_tt_resize();
+            }
+        }
+
+        void print_tt_resize() const{
+            std::cout << "info string hash resized to " << ttSize << " MB in " << ttResizeMs << " ms" << std::endl;
+        }
+
+        // Allocation is skipped if the size did not change, clearing is spread over all search threads.
+        void prepare_tt(){
+            auto start = std::chrono::high_resolution_clock::now();
+            const bool allocated = tt.allocate(ttSize);
+
+            auto cleared_start = std::chrono::high_resolution_clock::now();
+            tt.clear(threadCnt);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            auto allocation_ms = std::chrono::duration_cast<std::chrono::milliseconds>(cleared_start - start).count();
+            auto clear_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - cleared_start).count();
+
+            std::cout << "info string hash " << ttSize << " MB";
+            if (allocated)
+                std::cout << " allocated in " << allocation_ms << " ms,";
+            std::cout << " cleared in " << clear_ms << " ms" << std::endl;
+        }
     };
 }
 
@@ -18,6 +18,7 @@ namespace Sigmoid {
         TranspositionTable* tt;
         WorkerHelper* workerHelper;
         SearchResult result;
+        TTStats ttStats;
         Timer* timer;
         int searchDepth;
 
@@ -127,39 +128,31 @@ namespace Sigmoid {
             if (stack->ply >= MAX_PLY)
                 return board.eval();
 
+            if (depth <= 0)
+                return q_search(alpha, beta, stack);
+
             const bool is_singular = stack->excludedMove != Move::none();
 
-            auto [entry, tt_hit] = tt->probe(board.key());
+            auto [entry, tt_hit] = tt->probe(board.key(), depth, &ttStats);
             const bool tt_capture = tt_hit && board.is_capture(entry.move);
 
             if (!pv_node && tt_hit && entry.depth >= depth && !is_singular){
-
-                auto correct_tt_eval = [&stack](int16_t eval)-> int16_t {
-                    auto abs_eval = std::abs(eval);
-                    if(abs_eval >= CHECKMATE_BOUND)
-                        eval -= stack->ply * (abs_eval/eval);
-                    return eval;
-                };
-
-                int16_t corrected_eval = correct_tt_eval(entry.eval);
-                if (entry.flag == EXACT)
+                int16_t corrected_eval = correct_tt_eval(entry.eval, stack->ply);
+                if (entry.flag() == EXACT)
                     return corrected_eval;
-                if (entry.flag == UPPER_BOUND && entry.eval <= alpha)
+                if (entry.flag() == UPPER_BOUND && entry.eval <= alpha)
                     return corrected_eval;
-                if (entry.flag == LOWER_BOUND && entry.eval >= beta)
+                if (entry.flag() == LOWER_BOUND && entry.eval >= beta)
                     return corrected_eval;
             }
 
-            if (depth <= 0)
-                return q_search(alpha, beta, stack);
-
             int16_t alpha_md = std::max(int(alpha), -CHECKMATE + stack->ply);
             int16_t beta_md = std::min(int(beta), CHECKMATE - stack->ply - 1);
             if(!root_node && alpha_md >= beta_md)
                 return alpha_md;
 
             stack->can_null = (stack - 1)->can_null;
-            const int16_t static_eval = stack->eval = board.eval();
+            const int16_t static_eval = stack->eval = tt_hit && entry.staticEval != NO_EVAL ? entry.staticEval : board.eval();
             const bool in_check = board.in_check();
             const bool improving = stack->eval > (stack - 2)->eval;
 
@@ -254,7 +247,7 @@ namespace Sigmoid {
                 // Singular extensions.
                 int extension = 0;
                 if (!root_node && move == entry.move &&
-                    depth >= 8 && entry.flag != UPPER_BOUND
+                    depth >= 8 && entry.flag() != UPPER_BOUND
                     && entry.depth + 3 >= depth && std::abs(entry.eval) < CHECKMATE_BOUND){
 
                     const int16_t singular_beta = entry.eval - depth;
@@ -283,9 +276,7 @@ namespace Sigmoid {
                     move_score = mainHistory[board.whoPlay][move.from()][move.to()];
                 }
 
-                if (!board.make_move(move))
-                    continue;
-
+                board.make_move(move);
                 result.nodesVisited++;
                 move_count++;
                 tt->prefetch(board.key());
@@ -380,27 +371,45 @@ namespace Sigmoid {
                 return DRAW;
 
             if (!is_singular)
-                tt->store(board.key(), best_move, flag, depth, best_value, stack->ply);
+                tt->store(board.key(), best_move, flag, depth, best_value, static_eval, stack->ply, &ttStats);
 
             return best_value;
         }
 
         //template<NodeType nodeType>
         int16_t q_search(int16_t alpha, int16_t beta, StackItem* stack) {
-            int16_t best_value = board.eval();
+            const bool pv_node = beta - alpha > 1;
+
+            auto [entry, tt_hit] = tt->probe(board.key(), 0, &ttStats);
+            if (!pv_node && tt_hit){
+                int16_t corrected_eval = correct_tt_eval(entry.eval, stack->ply);
+                if (entry.flag() == EXACT)
+                    return corrected_eval;
+                if (entry.flag() == UPPER_BOUND && entry.eval <= alpha)
+                    return corrected_eval;
+                if (entry.flag() == LOWER_BOUND && entry.eval >= beta)
+                    return corrected_eval;
+            }
+
+            const int16_t static_eval = tt_hit && entry.staticEval != NO_EVAL ? entry.staticEval : board.eval();
+            int16_t best_value = static_eval;
             if (stack->ply >= MAX_PLY)
                 return best_value;
 
-            if (best_value >= beta)
+            if (best_value >= beta){
+                if (!tt_hit)
+                    tt->store(board.key(), Move::none(), LOWER_BOUND, 0, best_value, static_eval, stack->ply, &ttStats);
                 return best_value;
+            }
             if (best_value > alpha)
                 alpha = best_value;
 
             if (result.nodesVisited & 2048 && is_time_out())
                 return MIN_VALUE;
 
-            MoveList<true> ml(&board);
+            MoveList<true> ml(&board, &entry.move);
             Move move;
+            Move best_move = Move::none();
 
             const bool in_check = board.in_check();
             while ((move = ml.get()) != Move::none()){
@@ -408,10 +417,9 @@ namespace Sigmoid {
                 if (!in_check && !board.see(move, 0))
                     continue;
 
-                if (!board.make_move(move))
-                    continue;
-
+                board.make_move(move);
                 result.nodesVisited++;
+                tt->prefetch(board.key());
                 int16_t value = static_cast<int16_t>(-q_search(-beta, -alpha, stack + 1));
 
                 board.undo_move();
@@ -422,17 +430,29 @@ namespace Sigmoid {
                 if (value > best_value) {
                     best_value = value;
 
-                    if (value > alpha)
+                    if (value > alpha){
                         alpha = value;
+                        best_move = move;
+                    }
 
                     if (value >= beta)
                         break;
                 }
             }
 
+            const TTFlag flag = best_value >= beta ? LOWER_BOUND : UPPER_BOUND;
+            tt->store(board.key(), best_move, flag, 0, best_value, static_eval, stack->ply, &ttStats);
+
             return best_value;
         }
 
+        // Mate scores are stored relative to the node, search uses them relative to the root.
+        static int16_t correct_tt_eval(int16_t eval, int ply){
+            auto abs_eval = std::abs(eval);
+            if(abs_eval >= CHECKMATE_BOUND)
+                eval -= ply * (abs_eval/eval);
+            return eval;
+        }
 
         template<bool pv_node>
         void update_pv(const int ply, const Move& move){
@@ -8,6 +8,7 @@
 #include "search.hpp"
 #include "constants.hpp"
 #include "timer.hpp"
+#include "tt.hpp"
 
 namespace Sigmoid{
 
@@ -19,8 +20,10 @@ namespace Sigmoid{
         bool datagen;
         uint64_t totalNodesVisited = 0ULL;
         Timer* timer;
+        TranspositionTable* tt;
 
-        WorkerHelper(int threadCnt, bool datagen, Timer* timer) : threadCnt(threadCnt), datagen(datagen), timer(timer) { }
+        WorkerHelper(int threadCnt, bool datagen, Timer* timer, TranspositionTable* tt)
+            : threadCnt(threadCnt), datagen(datagen), timer(timer), tt(tt) { }
 
         void enter_search_result(const int searchDepth, const SearchResult& searchResult){
             std::unique_lock lock(resultLock);
@@ -84,6 +87,7 @@ namespace Sigmoid{
 
             std::cout << " depth "<< searchDepth;
             std::cout << " nodes " << totalNodesVisited  << " time " << ms << " nps " << (totalNodesVisited * 1000) / ms;
+            std::cout << " hashfull " << tt->hashfull();
 
             std::cout << " pv ";
             for (int i = 0; i < bestResult.pvLength[0]; i++)